@@ -6,6 +6,7 @@
 #include <sys/socket.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 static int createNonblocking()
 {
@@ -21,8 +22,18 @@ Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr, bool reusepor
     : loop_(loop),
       acceptSocket_(createNonblocking()),       // 创建监听套接字
       acceptChannel_(loop, acceptSocket_.fd()), // 绑定Channel和socketfd
-      listenning_(false)
+      listenning_(false),
+      idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC)),
+      backlog_(1024),
+      deferAcceptSeconds_(0),
+      maxAcceptsPerWakeup_(16),
+      shedConnections_(0)
 {
+    for(std::atomic<uint64_t>& bucket : acceptsHistogram_)
+    {
+        bucket = 0;
+    }
+
     acceptSocket_.setReuseAddr(true);
     acceptSocket_.setReusePort(reuseport);
     acceptSocket_.bindAddress(listenAddr);      // bind
@@ -34,41 +45,108 @@ Acceptor::~Acceptor()
 {
     acceptChannel_.disableAll();
     acceptChannel_.remove();
+    if(idleFd_ >= 0)
+    {
+        ::close(idleFd_);
+    }
 }
 
 // TcpServer::start() 会调用此函数
 void Acceptor::listen()
 {
     listenning_ = true;
-    acceptSocket_.listen();             // listen
+    if(deferAcceptSeconds_ > 0)
+    {
+        acceptSocket_.setDeferAccept(deferAcceptSeconds_);
+    }
+    acceptSocket_.listen(backlog_);     // listen
     acceptChannel_.enableReading();     // 在Poller中关注可读事件
 }
 
 // listenfd 有事件发生 -> 有新用户连接 调用此函数 (事先被注册到 acceptChannel_ 的 ReadCallback中)
+// 一次最多取maxAcceptsPerWakeup_个连接，直到全连接队列为空
 void Acceptor::handleRead()
 {
-    InetAddress peerAddr;
-    int connfd = acceptSocket_.accept(&peerAddr);
-    if(connfd >= 0)
+    int accepted = 0;
+    while(accepted < maxAcceptsPerWakeup_)
     {
-        if(NewConnectionCallback_)
+        InetAddress peerAddr;
+        int connfd = acceptSocket_.accept(&peerAddr);
+        if(connfd >= 0)
+        {
+            ++accepted;
+            if(NewConnectionCallback_)
+            {
+                // 轮询找到subLoop，唤醒，分发当前的新客户端的Channel
+                NewConnectionCallback_(connfd, peerAddr);
+            }
+            else
+            {
+                ::close(connfd);
+            }
+            continue;
+        }
+
+        int savedErrno = errno;
+        if(savedErrno == EAGAIN || savedErrno == EWOULDBLOCK)
+        {
+            break;  // 队列已经取空
+        }
+        else if(savedErrno == EMFILE || savedErrno == ENFILE)
+        {
+            // 表示当前进程(或系统)打开的文件描述符已达上限
+            // 不处理的话LT模式下listenfd会一直可读，这里拒绝掉一个连接，下次唤醒再继续
+            LOG_INFO("%s:%s:%d sockfd reached limit, shedding connection\n", __FILE__, __FUNCTION__, __LINE__);
+            shedOneConnection();
+            break;
+        }
+        else if(savedErrno == ECONNABORTED || savedErrno == EINTR || savedErrno == EPROTO
+                || savedErrno == EPERM || savedErrno == ENOBUFS || savedErrno == ENOMEM)
         {
-            // 轮询找到subLoop，唤醒，分发当前的新客户端的Channel
-            NewConnectionCallback_(connfd, peerAddr);   
+            // 连接在accept之前被对端重置、被防火墙拒绝或者内存暂时不足，不影响后面的连接
+            LOG_INFO("%s:%s:%d accept err:%d\n", __FILE__, __FUNCTION__, __LINE__, savedErrno);
+            if(savedErrno == ENOBUFS || savedErrno == ENOMEM)
+            {
+                break;
+            }
         }
         else
         {
-            ::close(connfd);
+            LOG_FATAL("%s:%s:%d accept err:%d\n", __FILE__, __FUNCTION__, __LINE__, savedErrno);
         }
     }
-    else
+
+    int bucket = 0;
+    while(bucket < kHistogramBuckets - 1 && (accepted >> bucket) != 0)
     {
-        LOG_ERROR("%s:%s:%d accept err:%d\n", __FILE__, __FUNCTION__, __LINE__, errno);
-        // 表示当前进程打开的文件描述符已达上限
-        if(errno == EMFILE)
-        {
-            LOG_ERROR("%s:%s:%d sockfd reached limit!\n", __FILE__, __FUNCTION__, __LINE__);
-            // muduo原本的处理方式是关闭事先创建的idleFd_，再去关闭accept让这个事件不会一直触发，不至于让LT模式产生坏的影响
-        }    
+        ++bucket;
+    }
+    acceptsHistogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// muduo的做法：关闭预留的idleFd_腾出一个fd，accept这个连接后马上关闭，再重新占住idleFd_
+void Acceptor::shedOneConnection()
+{
+    if(idleFd_ < 0)
+    {
+        return;
+    }
+    ::close(idleFd_);
+    idleFd_ = ::accept(acceptSocket_.fd(), nullptr, nullptr);
+    if(idleFd_ >= 0)
+    {
+        ::close(idleFd_);
+        ++shedConnections_;
+    }
+    idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+std::vector<uint64_t> Acceptor::acceptsHistogram() const
+{
+    std::vector<uint64_t> histogram;
+    for(const std::atomic<uint64_t>& bucket : acceptsHistogram_)
+    {
+        histogram.push_back(bucket.load(std::memory_order_relaxed));
     }
+    return histogram;
 }
\ No newline at end of file
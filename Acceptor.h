@@ -4,6 +4,9 @@
 #include "Channel.h"
 
 #include <functional>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
 
 class EventLoop;
 class InetAddress;
@@ -28,14 +31,39 @@ public:
     }
 
     bool listenning() const { return listenning_; }
+    EventLoop* ownerLoop() const { return loop_; }
     void listen();
 
+    // 以下选项需要在listen()之前设置
+    void setBacklog(int backlog) { backlog_ = backlog; }
+    void setDeferAccept(int seconds) { deferAcceptSeconds_ = seconds; }
+    // 每次可读事件最多accept的连接数，连接风暴时一次唤醒取走多个连接
+    void setMaxAcceptsPerWakeup(int n) { maxAcceptsPerWakeup_ = n > 0 ? n : 1; }
+    // 每个loop一个SO_REUSEPORT监听socket时，让内核把在这个CPU上收到的连接交给这个acceptor
+    void setIncomingCpu(int cpu) { acceptSocket_.setIncomingCpu(cpu); }
+
+    /**
+     *  每次可读事件accept到的连接数的直方图，可以跨线程读取
+     *  下标i统计的是accept数在[2^(i-1), 2^i)之间的唤醒次数，下标0是一个连接都没取到的唤醒，最后一项包含更大的值
+     */
+    static const int kHistogramBuckets = 8;
+    std::vector<uint64_t> acceptsHistogram() const;
+    uint64_t shedConnections() const { return shedConnections_; }  // fd耗尽时被直接关闭的连接数
+
 private:
     void handleRead();  // 可读回调函数
+    void shedOneConnection();   // fd耗尽时，用预留的fd接受一个连接再关闭它
 
     EventLoop* loop_;   // Acceptor用的就是用户定义的那个baseLoop，也称作mainLoop
     Socket acceptSocket_;       // 监听套接字 
     Channel acceptChannel_;     // 和监听套接字绑定的Channel
     NewConnectionCallback NewConnectionCallback_;   // 一旦有新连接，就执行此回调函数
     bool listenning_;       //  acceptChannel所处的EventLoop是否处于监听状态
+    int idleFd_;            //  预留的空闲fd，进程的fd用完时关闭它腾出一个位置
+    int backlog_;
+    int deferAcceptSeconds_;
+    int maxAcceptsPerWakeup_;
+
+    std::atomic<uint64_t> acceptsHistogram_[kHistogramBuckets];
+    std::atomic<uint64_t> shedConnections_;
 };
\ No newline at end of file
@@ -3,34 +3,353 @@
 #include <errno.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <algorithm>
+
+const char Buffer::kEmpty[1] = {0};
+
+Buffer::Block* Buffer::allocBlock(size_t capacity)
+{
+    BufferPool* pool = BufferPool::current();
+    size_t size = sizeof(Block) + capacity;
+    Block* block = static_cast<Block*>(pool->allocate(&size));
+    block->next = nullptr;
+    block->pool = pool;
+    block->capacity = size - sizeof(Block);
+    block->readIndex = 0;
+    block->writeIndex = 0;
+    return block;
+}
+
+// 块可能在另一个线程中释放(比如连接迁移之后)，放进释放线程的池
+void Buffer::freeBlock(Block* block)
+{
+    BufferPool::release(block->pool, block, sizeof(Block) + block->capacity);
+}
+
+Buffer::Buffer(size_t initialSize)
+    : head_(nullptr),
+      tail_(nullptr),
+      readable_(0),
+      initialSize_(initialSize),
+      spare_(nullptr),
+      spareCapacity_(kPooledCapacity),
+      ringCapacity_(0),
+      ringRead_(0)
+{
+}
+
+Buffer::~Buffer()
+{
+    retrieveAll();
+}
+
+void Buffer::setMirroredRing(size_t capacity)
+{
+    if(readable_ > 0)
+    {
+        return;
+    }
+    retrieveAll();
+    ring_.reset();
+    ringCapacity_ = capacity;
+}
+
+void Buffer::growRing(size_t len)
+{
+    size_t capacity = ring_ ? ring_->capacity() : ringCapacity_;
+    while(capacity < readable_ + len)
+    {
+        capacity *= 2;
+    }
+    std::unique_ptr<MirroredRing> ring = MirroredRing::create(capacity);
+    if(!ring)
+    {
+        // 退回块链表模式，已有的数据拷到块里
+        std::unique_ptr<MirroredRing> old;
+        old.swap(ring_);
+        size_t readable = readable_;
+        readable_ = 0;
+        ringCapacity_ = 0;
+        if(readable > 0)
+        {
+            appendAcrossBlocks(old->base() + ringRead_, readable);
+        }
+        ringRead_ = 0;
+        return;
+    }
+    if(ring_ && readable_ > 0)
+    {
+        // 镜像映射保证可读数据是连续的，一次拷贝
+        ::memcpy(ring->base(), ring_->base() + ringRead_, readable_);
+    }
+    ring_.swap(ring);
+    ringCapacity_ = ring_->capacity();
+    ringRead_ = 0;
+}
+
+void Buffer::retrieveAll()
+{
+    // 环一直保留到Buffer析构
+    ringRead_ = 0;
+    while(head_)
+    {
+        Block* next = head_->next;
+        freeBlock(head_);
+        head_ = next;
+    }
+    tail_ = nullptr;
+    readable_ = 0;
+    if(spare_)
+    {
+        freeBlock(spare_);
+        spare_ = nullptr;
+    }
+}
+
+// len < readable_，跨过的块还给块池
+void Buffer::retrieveAcrossBlocks(size_t len)
+{
+    readable_ -= len;
+    while(len >= head_->readable())
+    {
+        len -= head_->readable();
+        Block* next = head_->next;
+        freeBlock(head_);
+        head_ = next;
+    }
+    head_->readIndex += len;
+}
+
+std::string Buffer::retrieveAsString(size_t len)
+{
+    std::string result;
+    if(len == 0)
+    {
+        return result;
+    }
+    if(ring_)
+    {
+        result.assign(peek(), len);
+    }
+    else if(len <= head_->readable())
+    {
+        result.assign(head_->data() + head_->readIndex, len);
+    }
+    else
+    {
+        // 逐块拷贝，不需要先合并
+        result.reserve(len);
+        size_t remaining = len;
+        for(Block* block = head_; remaining > 0; block = block->next)
+        {
+            size_t n = std::min(remaining, block->readable());
+            result.append(block->data() + block->readIndex, n);
+            remaining -= n;
+        }
+    }
+    retrieve(len);
+    return result;
+}
+
+void Buffer::appendBlock(Block* block)
+{
+    if(tail_)
+    {
+        tail_->next = block;
+    }
+    else
+    {
+        head_ = block;
+    }
+    tail_ = block;
+}
+
+// 尾块没有数据时(尾块是之前挂上的空块)直接换掉，否则挂一个新块；还没有块时分配第一个块
+void Buffer::makeSpace(size_t len)
+{
+    if(ringCapacity_ > 0)
+    {
+        growRing(len);
+        if(ring_)
+        {
+            return;
+        }
+    }
+    if(!tail_)
+    {
+        Block* block = allocBlock(kCheapPrepend + std::max(len, initialSize_));
+        block->readIndex = block->writeIndex = kCheapPrepend;
+        head_ = tail_ = block;
+        return;
+    }
+    if(tail_->readable() == 0 && tail_->capacity >= kCheapPrepend + len)
+    {
+        tail_->readIndex = tail_->writeIndex = kCheapPrepend;
+        return;
+    }
+    Block* block = allocBlock(len);
+    if(tail_->readable() == 0)
+    {
+        // 空的尾块要么是头块(缓冲区为空)，要么跟在有数据的块后面
+        Block* prev = nullptr;
+        for(Block* b = head_; b != tail_; b = b->next)
+        {
+            prev = b;
+        }
+        freeBlock(tail_);
+        if(prev)
+        {
+            prev->next = block;
+        }
+        else
+        {
+            head_ = block;
+        }
+        tail_ = block;
+    }
+    else
+    {
+        appendBlock(block);
+    }
+}
+
+void Buffer::appendAcrossBlocks(const char* data, size_t len)
+{
+    if(ringCapacity_ > 0)
+    {
+        growRing(len);
+        if(ring_)
+        {
+            ::memcpy(beginWrite(), data, len);
+            readable_ += len;
+            return;
+        }
+    }
+    if(!tail_)
+    {
+        makeSpace(std::min(len, kMaxPooledCapacity - kCheapPrepend));
+    }
+    readable_ += len;
+    while(true)
+    {
+        size_t n = std::min(len, tail_->capacity - tail_->writeIndex);
+        ::memcpy(tail_->data() + tail_->writeIndex, data, n);
+        tail_->writeIndex += n;
+        data += n;
+        len -= n;
+        if(len == 0)
+        {
+            break;
+        }
+        // 新块至少kBlockSize，大块数据用池中最大的块，都能从BufferPool中复用
+        size_t capacity = std::max(len, static_cast<size_t>(kPooledCapacity));
+        appendBlock(allocBlock(std::min(capacity, static_cast<size_t>(kMaxPooledCapacity))));
+    }
+}
+
+void Buffer::linearize() const
+{
+    // 留出和可读数据一样多的空闲区，后续到达的数据直接读进来，按倍数增长
+    Block* block = allocBlock(kCheapPrepend + 2 * readable_);
+    block->readIndex = kCheapPrepend;
+    block->writeIndex = kCheapPrepend;
+    while(head_)
+    {
+        ::memcpy(block->data() + block->writeIndex, head_->data() + head_->readIndex, head_->readable());
+        block->writeIndex += head_->readable();
+        Block* next = head_->next;
+        freeBlock(head_);
+        head_ = next;
+    }
+    head_ = tail_ = block;
+}
 
 /**
  *  从fd上读取数据  Poller工作在LT模式
  *  Buffer缓冲区是有大小的！ 但是从fd上读数据的时候，却不知道tcp数据最终的大小
+ *
+ *  给readv的第一段是尾块剩余的空闲区，不够kReadSize字节时第二段是备用块spare_。
+ *  读到的数据直接落在块里，用到的备用块挂到链表尾部，没用到的留给下一次，不需要再从栈上的临时缓冲区拷贝一次。
+ *  备用块读满说明fd上的数据很多，下一个备用块加倍(最大是池中最大的块)；只用了很少一部分就减半。
+ *  如果读取了kReadSize字节数据，fd上的数据还是没有读完，那就等Poller下一次上报（工作在LT模式），继续读取，数据不会丢失
  */
+ssize_t Buffer::readFd(int fd, int* saveErrno)
+{
+    if(ringCapacity_ > 0)
+    {
+        if(!ring_)
+        {
+            growRing(0);
+        }
+        if(ring_)
+        {
+            return readRing(fd, saveErrno);
+        }
+    }
+
+    struct iovec vec[2];
+    int iovcnt = 0;
+    const size_t writable = writableBytes();    // 尾块剩余的可写空间大小
+    if(writable > 0)
+    {
+        vec[iovcnt].iov_base = beginWrite();
+        vec[iovcnt].iov_len = writable;
+        ++iovcnt;
+    }
+    if(writable < kReadSize)
+    {
+        if(!spare_)
+        {
+            spare_ = allocBlock(spareCapacity_);
+        }
+        vec[iovcnt].iov_base = spare_->data();
+        vec[iovcnt].iov_len = spare_->capacity;
+        ++iovcnt;
+    }
+
+    const ssize_t n = iovcnt == 1 ? ::read(fd, vec[0].iov_base, vec[0].iov_len) : ::readv(fd, vec, iovcnt);
+    if(n < 0)
+    {
+        *saveErrno = errno;
+    }
+
+    size_t remaining = n > 0 ? n : 0;
+    readable_ += remaining;
+    size_t m = std::min(remaining, writable);
+    if(m > 0)
+    {
+        tail_->writeIndex += m;
+        remaining -= m;
+    }
+    if(remaining > 0)
+    {
+        if(remaining == spare_->capacity)
+        {
+            spareCapacity_ = std::min(spareCapacity_ * 2, static_cast<size_t>(kMaxPooledCapacity));
+        }
+        else if(remaining < spare_->capacity / 4)
+        {
+            spareCapacity_ = std::max(spareCapacity_ / 2, static_cast<size_t>(kPooledCapacity));
+        }
+        spare_->writeIndex = remaining;
+        appendBlock(spare_);
+        spare_ = nullptr;
+    }
+    return n;
+}
 
 /**
- * 这里有个小技巧，就是巧妙运用了栈的空间，如果读取的数据不多，没有超过Buffer的长度，那么直接读取到Buffer里，
- * 如果大于Buffer的可写长度，那么我们就先用栈保存起来， 这样不用把Buffer的长度设置的太大，免得避免浪费，
- * 只有在Buffer的长度不够用时，才会进行扩容。然后将栈里数据追加到Buffer里，最后这个局部变量栈空间在函数结束时，就自动释放了。
- * 保证每次至少读64K数据，减少了系统调用，同时使用栈空间而不是堆空间减少了内存占用
- * 使用了65536字节的栈空间，开辟效率高，回收快，用于存储Buffer对象无法存储的，剩余的数据
- * 
- * 我们给readv两个缓冲区，第一个就是Buffer对象的空间（一般是堆空间），第二个是65536字节的栈空间。
- * readv会先写入第一个缓冲区，没写完再写入第二个缓冲区。
- * 如果读取了65536字节数据，fd上的数据还是没有读完，那就等Poller下一次上报（工作在LT模式），继续读取，数据不会丢失
+ *  镜像环形缓冲区模式下，环上剩余的可写空间是连续的，放在readv的第一段；
+ *  环快满时和原来的实现一样用64K的栈空间接住多出来的数据，再扩大环追加进去
  */
-ssize_t Buffer::readFd(int fd, int* saveErrno)
+ssize_t Buffer::readRing(int fd, int* saveErrno)
 {
-    // 巧妙地利用栈空间， 减少了系统调用和内存占用
-    char extrabuf[65536] = {0};     // 栈空间 64K
-
+    char extrabuf[kReadSize];
     struct iovec vec[2];
 
-    const size_t writable = writableBytes();    // Buffer底层缓冲区剩余的可写空间大小
-    vec[0].iov_base = begin() + writerIndex_;
+    const size_t writable = writableBytes();
+    vec[0].iov_base = beginWrite();
     vec[0].iov_len = writable;
-
     vec[1].iov_base = extrabuf;
     vec[1].iov_len = sizeof extrabuf;
 
@@ -40,24 +359,47 @@ ssize_t Buffer::readFd(int fd, int* saveErrno)
     {
         *saveErrno = errno;
     }
-    else if(n <= writable)  // Buffer的可写缓冲区已经够存储读出来的数据了
+    else if(static_cast<size_t>(n) <= writable)
     {
-        writerIndex_ += n;
+        readable_ += n;
     }
-    else // extrabuf里面也写入了数据
+    else
     {
-        writerIndex_ = buffer_.size();
-        append(extrabuf, n - writable);  // writerIndex_开始写 n - writable大小的数据, append会调用makeSpace扩容
+        readable_ += writable;
+        append(extrabuf, n - writable);
     }
     return n;
 }
 
-ssize_t Buffer::writeFd(int fd, int* saveErrno)
+ssize_t Buffer::writeFd(int fd, int* saveErrno, size_t maxBytes)
 {
-    ssize_t n = ::write(fd, peek(), readableBytes());
+    if(ring_)
+    {
+        ssize_t n = ::write(fd, peek(), std::min(readable_, maxBytes));
+        if(n < 0)
+        {
+            *saveErrno = errno;
+        }
+        return n;
+    }
+
+    struct iovec vec[kMaxWriteBlocks];
+    int iovcnt = 0;
+    for(Block* block = head_; block && iovcnt < kMaxWriteBlocks && maxBytes > 0; block = block->next)
+    {
+        if(block->readable() > 0)
+        {
+            vec[iovcnt].iov_base = block->data() + block->readIndex;
+            vec[iovcnt].iov_len = std::min(block->readable(), maxBytes);
+            maxBytes -= vec[iovcnt].iov_len;
+            ++iovcnt;
+        }
+    }
+
+    ssize_t n = iovcnt == 1 ? ::write(fd, vec[0].iov_base, vec[0].iov_len) : ::writev(fd, vec, iovcnt);
     if(n < 0)
     {
         *saveErrno = errno;
     }
     return n;
-}
\ No newline at end of file
+}
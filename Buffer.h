@@ -1,80 +1,128 @@
 #pragma once
 
-#include <vector>
+#include "noncopyable.h"
+#include "BufferPool.h"
+#include "MirroredRing.h"
+
+#include <memory>
 #include <string>
 #include <algorithm>
+#include <sys/types.h>
+#include <string.h>
 
 
 /**
+ *  Buffer 由固定大小的块串成的链表，块从当前线程(也就是当前loop)的BufferPool中分配
+ *  原来的实现是一个std::vector<char>，空间不够时要么realloc并拷贝全部可读数据，要么把未读数据memmove到前面，
+ *  大的流水线响应会被反复拷贝。现在追加数据只是写满尾块再挂新块，取走数据只是移动头块的读指针，
+ *  读完的块还给块池，已有的数据不会被搬动。
+ *  readFd用readv直接读进尾块的空闲区和若干新块，writeFd用writev一次写出多个块。
+ *
+ *  每个块内部：
  * prependable bytes：表示数据包的字节数
- * readerIndex：应用程序从readerIndex指向的位置开始读缓冲区，[readerIndex, writerIndex]表示待读取数据，
+ * readIndex：应用程序从readIndex指向的位置开始读缓冲区，[readIndex, writeIndex]表示待读取数据，
  * 读完后向后移动len（retrieve方法）
- * writerIndex：应用程序从writerIndex指向的位置开始写缓冲区，写完后writerIndex向后移动len（append方法）
- * [readerIndex_, writerIndex_]：标识可读数据区间（readableBytes方法） 
+ * writeIndex：应用程序从writeIndex指向的位置开始写缓冲区，写完后writeIndex向后移动len（append方法）
+ *
+ *  peek()返回连续的可读数据：可读数据都在头块里时直接返回(常见情况)，跨了多个块时先合并成一个块。
+ *  合并出来的块留出和数据一样大的空闲区，后面的readFd直接读进这个块，大消息分多次到达时
+ *  不会每次都重新合并，合并拷贝的总量和消息大小成线性关系。
+ *
+ *  构造时不分配内存，第一次写入数据时才分配；数据全部取走后所有块都还给BufferPool，
+ *  空闲的连接不占用缓冲区内存。
+ *
+ *  另一种模式是镜像环形缓冲区(setMirroredRing)，数据放在MirroredRing上，可读数据总是连续的，
+ *  peek()不需要合并，数据绕回也不需要搬动。适合缓冲区长期半满的流水线协议。
+ *  环在第一次写入时创建，之后一直保留到Buffer析构；空间不够时换一个两倍大的环，把可读数据拷过去。
  */
-class Buffer
+class Buffer : noncopyable
 {
 public:
     // 通过预留 kCheapPrependable 空间，可以简化客户代码，一个简单的空间换时间思路
     static const size_t kCheapPrepend = 8;
     static const size_t kInitiaSize = 1024;
+    static const size_t kBlockSize = 4096;      // 块池中每个块的大小，包括块头
+
+    explicit Buffer(size_t initialSize = kInitiaSize);
+    ~Buffer();
 
-    explicit Buffer(size_t initialSize = kInitiaSize)
-        : buffer_(kCheapPrepend + initialSize),
-          readerIndex_(kCheapPrepend),
-          writerIndex_(kCheapPrepend)
-    {}
+    // 切换到镜像环形缓冲区模式，capacity是环的初始大小，只能在缓冲区为空时调用。
+    // 创建环失败(memfd/mmap出错)时退回块链表模式
+    void setMirroredRing(size_t capacity);
+    bool mirroredRing() const { return ringCapacity_ > 0; }
 
     size_t readableBytes() const
     {
-        return writerIndex_ - readerIndex_;
+        return readable_;
     }
 
+    // 尾块中连续的可写空间
     size_t writableBytes() const
     {
-        return buffer_.size() - writerIndex_;
+        if(ring_)
+        {
+            return ring_->capacity() - readable_;
+        }
+        return tail_ ? tail_->capacity - tail_->writeIndex : 0;
     }
 
     size_t prependableBytes() const
     {
-        return readerIndex_;
+        if(ring_)
+        {
+            return 0;
+        }
+        return head_ ? head_->readIndex : 0;
     }
 
-    // 返回缓冲区可读数据的起始地址
+    // 返回缓冲区可读数据的起始地址，可读数据跨块时先合并，之后的readableBytes()字节都是连续的
     const char* peek() const
     {
-        return begin() + readerIndex_;
+        if(ring_)
+        {
+            return ring_->base() + ringRead_;
+        }
+        if(!head_)
+        {
+            return kEmpty;
+        }
+        if(head_->readable() < readable_)
+        {
+            linearize();
+        }
+        return head_->data() + head_->readIndex;
     }
 
-    void retrieveAll()
-    {
-        readerIndex_ = writerIndex_ = kCheapPrepend;
-    }
+    void retrieveAll();
 
     void retrieve(size_t len)
     {
         // len就是应用程序从Buffer缓冲区读取的数据长度
         // 必须要保证len <= readableBytes()
-        if(len < readableBytes())
+        if(ring_ && len < readable_)
+        {
+            ringRead_ = (ringRead_ + len) % ring_->capacity();
+            readable_ -= len;
+        }
+        else if(len < readable_ && len < head_->readable())
         {
-            // 可读数据没有读完
-            readerIndex_ += len;
+            // 头块中的数据没有读完，最常见的情况
+            head_->readIndex += len;
+            readable_ -= len;
+        }
+        else if(len < readable_)
+        {
+            retrieveAcrossBlocks(len);
         }
         else
         {
             // len == readableBytes()
-            // 可读数据读完了，readerIndex_ 和 writerIndex_都要复位
+            // 可读数据读完了，所有块都还给BufferPool
             retrieveAll();
         }
     }
 
-
-    std::string retrieveAsString(size_t len)
-    {
-        std::string result(peek(), len);    // peek返回缓冲区中可读数据的起始地址，从可读地址开始截取len个字符
-        retrieve(len);                      // result保存了缓冲区中的可读数据，retrieve将参数复位
-        return result;
-    }
+    std::string retrieveAsString(size_t len);
 
     // 把onMessage函数上报的Buffer数据，转成string类型的数据返回
     std::string retrieveAllAsString()
@@ -82,74 +130,125 @@ public:
         return retrieveAsString(readableBytes()); // 应用可读取数据的长度
     }
 
+    // 保证beginWrite()之后有len字节连续的可写空间
     void ensureWriteableBytes(size_t len)
     {
-        if(writableBytes() < len)
+        if(ring_ ? writableBytes() < len : (!tail_ || writableBytes() < len))
         {
-            // 扩容函数
+            // 挂一个足够大的新块
             makeSpace(len);
         }
     }
 
+    // 需要先调用ensureWriteableBytes
     char* beginWrite()
     {
-        return begin() + writerIndex_;
+        if(ring_)
+        {
+            return ring_->base() + (ringRead_ + readable_) % ring_->capacity();
+        }
+        return tail_->data() + tail_->writeIndex;
     }
 
     const char* beginWrite() const
     {
-        return begin() + writerIndex_;
-    }
-
-    // 不管是从fd上读数据写到缓冲区inputBuffer_，还是发数据要写入outputBuffer_，我们都要往writeable区间内添加数据
-    // 把[data, data + len]内存上的数据，添加到writable缓冲区当中
-    void append(const char* data, size_t len)
-    {
-        // 确保可写空间不小于len
-        ensureWriteableBytes(len);
-        // 把data中的数据往可写的位置writerIndex_写入
-        std::copy(data, data + len, beginWrite());
-        // len字节的data写入到Buffer后，就移动writerIndex_
-        writerIndex_ += len;
-    }
-
-    // 从fd上读取数据，存放到writerIndex_，返回实际读取的数据大小
-    ssize_t readFd(int fd, int* saveErrno);
-
-    // 通过fd发送数据
-    ssize_t writeFd(int fd, int* saveErrno);
-
-private:
-    char* begin()
-    {
-        // 返回vector底层数组首元素的地址，也就是数组的起始地址
-        return &*buffer_.begin();
+        if(ring_)
+        {
+            return ring_->base() + (ringRead_ + readable_) % ring_->capacity();
+        }
+        return tail_->data() + tail_->writeIndex;
     }
 
-    const char* begin() const
+    // 直接往beginWrite()写入len字节之后调用
+    void hasWritten(size_t len)
     {
-        return &*buffer_.begin();
+        if(!ring_)
+        {
+            tail_->writeIndex += len;
+        }
+        readable_ += len;
     }
 
-    void makeSpace(size_t len)
+    // 不管是从fd上读数据写到缓冲区inputBuffer_，还是发数据要写入outputBuffer_，我们都要往writeable区间内添加数据
+    // 把[data, data + len]内存上的数据，添加到缓冲区当中，尾块写满了就挂新块，不要求连续
+    void append(const char* data, size_t len)
     {
-        // 剩余空闲区间不够存储将要写入缓冲区的len数据了
-        if(writableBytes() + prependableBytes() < len + kCheapPrepend)
+        if((ring_ || tail_) && len <= writableBytes())
         {
-            // 直接在writerIndex_后面再扩大len的空间
-            buffer_.resize(writerIndex_ + len);
+            ::memcpy(beginWrite(), data, len);
+            hasWritten(len);
         }
-        else
+        else if(len > 0)
         {
-            // 如果是空闲空间足够存放len字节的数据，就把未读取的数据统一往前移，移到kCheapPrepend的位置
-            size_t readable = readableBytes();
-            std::copy(begin() + readerIndex_, begin() + writerIndex_, begin() + kCheapPrepend);
-            readerIndex_ = kCheapPrepend;
-            writerIndex_ = readerIndex_ + readable;
+            appendAcrossBlocks(data, len);
         }
     }
 
-    std::vector<char> buffer_;
-    size_t readerIndex_;
-    size_t writerIndex_;
-};
\ No newline at end of file
+    // 交换两个Buffer的内容，不拷贝数据
+    void swap(Buffer& other)
+    {
+        std::swap(head_, other.head_);
+        std::swap(tail_, other.tail_);
+        std::swap(readable_, other.readable_);
+        std::swap(initialSize_, other.initialSize_);
+        std::swap(ring_, other.ring_);
+        std::swap(ringCapacity_, other.ringCapacity_);
+        std::swap(ringRead_, other.ringRead_);
+        std::swap(spare_, other.spare_);
+        std::swap(spareCapacity_, other.spareCapacity_);
+    }
+
+    // 从fd上读取数据，存放到尾块和新的块中，返回实际读取的数据大小
+    ssize_t readFd(int fd, int* saveErrno);
+
+    // 通过fd发送最多maxBytes字节数据，一次最多写kMaxWriteBlocks个块，发送成功的部分由调用者retrieve
+    ssize_t writeFd(int fd, int* saveErrno, size_t maxBytes = static_cast<size_t>(-1));
+
+private:
+    // 块头和数据区在一次分配中，数据区紧跟在块头后面
+    struct Block
+    {
+        Block* next;
+        BufferPool* pool;   // 分配这个块的池
+        size_t capacity;    // 数据区的大小
+        size_t readIndex;
+        size_t writeIndex;
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+        size_t readable() const { return writeIndex - readIndex; }
+    };
+
+    static const size_t kPooledCapacity = kBlockSize - sizeof(Block);
+    static const size_t kMaxPooledCapacity = BufferPool::kMaxSize - sizeof(Block);
+    static const size_t kReadSize = 65536;      // readFd每次最多读取的字节数
+    static const int kMaxWriteBlocks = 64;
+    static const char kEmpty[1];
+
+    // 数据区至少capacity字节，按BufferPool的大小级别向上取整
+    static Block* allocBlock(size_t capacity);
+    static void freeBlock(Block* block);
+
+    void makeSpace(size_t len);
+    // 镜像环形缓冲区模式下创建或扩大环，保证至少len字节可写
+    void growRing(size_t len);
+    ssize_t readRing(int fd, int* saveErrno);
+    void appendBlock(Block* block);
+    void appendAcrossBlocks(const char* data, size_t len);
+    void retrieveAcrossBlocks(size_t len);
+    // 把所有可读数据合并到一个块中，不改变缓冲区的内容，所以可以在const函数中调用
+    void linearize() const;
+
+    // 没有数据时可以没有块(head_ == tail_ == nullptr)；除了尾块，其他块中都有可读数据
+    mutable Block* head_;
+    mutable Block* tail_;
+    size_t readable_;
+    size_t initialSize_;    // 第一个块的最小大小
+
+    // readFd的备用块：尾块的空闲区不够kReadSize时才分配，没读到数据就留到下一次，缓冲区清空时还给块池
+    Block* spare_;
+    size_t spareCapacity_;  // 下一个备用块的大小，读满就加倍，读得很少就减半
+
+    std::unique_ptr<MirroredRing> ring_;
+    size_t ringCapacity_;   // 大于0表示使用镜像环形缓冲区模式，ring_在第一次写入时创建
+    size_t ringRead_;       // 可读数据在环上的起始位置
+};
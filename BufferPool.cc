@@ -0,0 +1,135 @@
+#include "BufferPool.h"
+
+#include <new>
+#include <malloc.h>
+
+// 线程退出时释放池中缓存的块
+struct BufferPoolHolder
+{
+    BufferPool* pool = new BufferPool;
+
+    ~BufferPoolHolder() { pool->freeCached(); }
+};
+
+namespace
+{
+thread_local BufferPoolHolder t_holder;
+}
+
+BufferPool* BufferPool::current()
+{
+    return t_holder.pool;
+}
+
+BufferPool::BufferPool()
+    : bytesInUse_(0),
+      bytesCached_(0)
+{
+    for(int i = 0; i < kNumClasses; ++i)
+    {
+        heads_[i] = nullptr;
+        counts_[i] = 0;
+        lowWater_[i] = 0;
+    }
+}
+
+int BufferPool::classOf(size_t size)
+{
+    int index = 0;
+    size_t classSize = kMinSize;
+    while(classSize < size)
+    {
+        classSize <<= 1;
+        ++index;
+    }
+    return index;
+}
+
+void* BufferPool::allocate(size_t* size)
+{
+    bytesInUse_.fetch_add(*size > kMaxSize ? *size : kMinSize << classOf(*size), std::memory_order_relaxed);
+    if(*size > kMaxSize)
+    {
+        return ::operator new(*size);
+    }
+    int index = classOf(*size);
+    *size = kMinSize << index;
+    FreeBlock* block = heads_[index];
+    if(block)
+    {
+        heads_[index] = block->next;
+        if(--counts_[index] < lowWater_[index])
+        {
+            lowWater_[index] = counts_[index];
+        }
+        bytesCached_.fetch_sub(*size, std::memory_order_relaxed);
+        return block;
+    }
+    return ::operator new(*size);
+}
+
+void BufferPool::release(BufferPool* owner, void* mem, size_t size)
+{
+    owner->bytesInUse_.fetch_sub(size, std::memory_order_relaxed);
+    if(size > kMaxSize)
+    {
+        ::operator delete(mem);
+        return;
+    }
+    current()->cache(classOf(size), mem);
+}
+
+void BufferPool::cache(int index, void* mem)
+{
+    size_t size = kMinSize << index;
+    if(counts_[index] * size >= kMaxCachedBytesPerClass)
+    {
+        ::operator delete(mem);
+        return;
+    }
+    FreeBlock* block = static_cast<FreeBlock*>(mem);
+    block->next = heads_[index];
+    heads_[index] = block;
+    ++counts_[index];
+    bytesCached_.fetch_add(size, std::memory_order_relaxed);
+}
+
+void BufferPool::trim()
+{
+    bool freed = false;
+    for(int i = 0; i < kNumClasses; ++i)
+    {
+        size_t size = kMinSize << i;
+        for(size_t n = lowWater_[i]; n > 0 && heads_[i]; --n)
+        {
+            FreeBlock* block = heads_[i];
+            heads_[i] = block->next;
+            --counts_[i];
+            bytesCached_.fetch_sub(size, std::memory_order_relaxed);
+            ::operator delete(block);
+            freed = true;
+        }
+        lowWater_[i] = counts_[i];
+    }
+    if(freed)
+    {
+        // 释放的小块留在malloc的空闲链表里，让glibc把堆顶和空闲页还给系统
+        ::malloc_trim(0);
+    }
+}
+
+void BufferPool::freeCached()
+{
+    for(int i = 0; i < kNumClasses; ++i)
+    {
+        while(heads_[i])
+        {
+            FreeBlock* block = heads_[i];
+            heads_[i] = block->next;
+            ::operator delete(block);
+        }
+        bytesCached_.fetch_sub((kMinSize << i) * counts_[i], std::memory_order_relaxed);
+        counts_[i] = 0;
+        lowWater_[i] = 0;
+    }
+}
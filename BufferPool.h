@@ -0,0 +1,65 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ *  BufferPool 每个线程(one loop per thread，也就是每个loop)一个的缓冲区内存池
+ *  内存按2的幂分成kNumClasses个大小级别(1K ~ 64K)，Buffer的块从这里分配，缓冲区空了就把块还回来，
+ *  空闲块缓存在池中给下一个Buffer复用。超过kMaxSize的直接用operator new。
+ *
+ *  trim()定期由EventLoop调用：某一级的空闲块在整个间隔内一直没有被用到的部分(低水位)释放掉，
+ *  流量高峰之后持续空闲，池中缓存的内存会逐步还给系统。
+ *
+ *  bytesInUse()是从这个池分配出去、还在Buffer中的字节数，bytesCached()是池中空闲块的字节数，
+ *  都可以跨线程读取。块可能在另一个线程中释放(连接迁移)，这时计入释放线程的池，但从分配它的池的bytesInUse中扣除。
+ */
+class BufferPool : noncopyable
+{
+public:
+    static const int kNumClasses = 7;
+    static const size_t kMinSize = 1024;
+    static const size_t kMaxSize = kMinSize << (kNumClasses - 1);   // 64K
+    static const size_t kMaxCachedBytesPerClass = 4 * 1024 * 1024;
+
+    // 当前线程的池，第一次调用时创建。池对象在线程退出后也不释放(只释放缓存的块)，
+    // 其他线程中的块释放时还要更新它的计数
+    static BufferPool* current();
+
+    // 分配至少*size字节，*size返回实际大小
+    void* allocate(size_t* size);
+    // 可以在任何线程中调用，owner是分配这块内存的池
+    static void release(BufferPool* owner, void* mem, size_t size);
+
+    // 释放在上一个间隔内一直空闲的缓存块，只在池所在的线程中调用
+    void trim();
+
+    int64_t bytesInUse() const { return bytesInUse_.load(std::memory_order_relaxed); }
+    // 不从池中分配、但属于缓冲区的内存(比如MirroredRing)，可以在任何线程中调用
+    void addBytesInUse(int64_t delta) { bytesInUse_.fetch_add(delta, std::memory_order_relaxed); }
+    int64_t bytesCached() const { return bytesCached_.load(std::memory_order_relaxed); }
+
+private:
+    BufferPool();
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    static int classOf(size_t size);
+    void cache(int index, void* mem);
+    void freeCached();
+
+    FreeBlock* heads_[kNumClasses];
+    size_t counts_[kNumClasses];
+    size_t lowWater_[kNumClasses];      // 上次trim以来空闲块数的最小值
+
+    std::atomic<int64_t> bytesInUse_;
+    std::atomic<int64_t> bytesCached_;
+
+    friend struct BufferPoolHolder;
+};
@@ -9,7 +9,7 @@ const int Channel::kReadEvent = EPOLLIN | EPOLLPRI;    //可读事件
 const int Channel::kWriteEvent = EPOLLOUT;   //可写事件
 
 Channel::Channel(EventLoop* loop, int fd)
-    : loop_(loop), fd_(fd), events_(0), revents_(0), index_(-1), tied_(false) {}
+    : loop_(loop), fd_(fd), events_(0), revents_(0), edgeTriggered_(false), dirty_(false), tied_(false) {}
 
 Channel::~Channel() {}
 
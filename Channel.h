@@ -48,6 +48,7 @@ public:
     int events() const { return events_; }
     //设置就绪的事件
     void set_revents(int revt) { revents_ = revt; }
+    int revents() const { return revents_; }
 
     //设置fd相应的事件状态
     void enableReading() { events_ |= kReadEvent; update(); }
@@ -62,11 +63,18 @@ public:
     bool isWriting() const { return events_ & kWriteEvent; }
     bool isReading() const { return events_ & kReadEvent; }
 
-    int index() { return index_; }
-    void set_index(int idx) { index_ = idx; }
+    //边缘触发(EPOLLET)模式，由Poller在注册事件时附加，事件回调需要一直读写到EAGAIN
+    void setEdgeTriggered(bool on) { edgeTriggered_ = on; if(!isNoneEvent()) update(); }
+    bool edgeTriggered() const { return edgeTriggered_; }
+
+    //是否有还没提交给poller的事件修改，由EventLoop维护
+    bool dirty() const { return dirty_; }
+    void setDirty(bool on) { dirty_ = on; }
 
     //one loop per thread
     EventLoop* ownerLoop() { return loop_; }
+    //把channel挂到另一个loop上，并在新loop的poller中注册当前关注的事件，调用前需要先remove()
+    void setLoop(EventLoop* loop) { loop_ = loop; if(!isNoneEvent()) update(); }
     void remove();
 
 private:
@@ -82,7 +90,8 @@ private:
     const int fd_;      //fd, Poller监听的对象 
     int events_;        //注册fd感兴趣的事件
     int revents_;       //Poller返回的就绪的事件
-    int index_;         //被Poller使用的下标
+    bool edgeTriggered_;    //是否以边缘触发模式注册
+    bool dirty_;            //是否在EventLoop的dirty列表中
 
     std::weak_ptr<void> tie_;
     bool tied_;
@@ -0,0 +1,159 @@
+#include "ComputePool.h"
+
+#include <stdio.h>
+
+namespace
+{
+// 当前线程是哪个ComputePool的第几个工作线程，工作线程提交的任务直接放进自己的队列
+thread_local ComputePool* t_pool = nullptr;
+thread_local size_t t_index = 0;
+}
+
+ComputePool::ComputePool(const std::string& name)
+    : name_(name),
+      numThreads_(0),
+      running_(false),
+      next_(0),
+      pending_(0),
+      steals_(0),
+      executed_(0)
+{
+}
+
+ComputePool::~ComputePool()
+{
+    stop();
+}
+
+void ComputePool::start()
+{
+    if(running_ || numThreads_ <= 0)
+    {
+        return;
+    }
+    running_ = true;
+    for(int i = 0; i < numThreads_; ++i)
+    {
+        workers_.emplace_back(new Worker);
+    }
+    for(int i = 0; i < numThreads_; ++i)
+    {
+        char buf[name_.size() + 32];
+        snprintf(buf, sizeof buf, "%s%d", name_.c_str(), i);
+        threads_.emplace_back(new Thread(std::bind(&ComputePool::threadFunc, this, i), buf));
+        threads_.back()->start();
+    }
+}
+
+void ComputePool::stop()
+{
+    if(!running_)
+    {
+        return;
+    }
+    {
+        // 和submit中的检查互斥：设置之后不会再有外部线程的任务放进队列
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    for(std::unique_ptr<Thread>& thread : threads_)
+    {
+        thread->join();
+    }
+    threads_.clear();
+}
+
+bool ComputePool::submit(Functor&& task)
+{
+    {
+        /**
+         *  检查running_和放进队列都在mutex_中完成：stop设置running_之后不会再有外部任务进来，
+         *  工作线程在mutex_中看到pending_为0才退出，已经放进队列的任务一定会被执行。
+         *  同时和threadFunc中的wait配对，避免工作线程检查完pending_之后、睡眠之前错过通知
+         */
+        std::lock_guard<std::mutex> lock(mutex_);
+        // stop之后工作线程还在执行剩下的任务，这时它们提交的任务(比如Strand的下一批)也要接收
+        if(!running_ && t_pool != this)
+        {
+            return false;
+        }
+        size_t index = t_pool == this ? t_index : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+        {
+            std::lock_guard<std::mutex> workerLock(workers_[index]->mutex);
+            workers_[index]->tasks.push_back(std::move(task));
+        }
+        pending_.fetch_add(1);
+    }
+    cond_.notify_one();
+    return true;
+}
+
+std::vector<size_t> ComputePool::queueDepths() const
+{
+    std::vector<size_t> depths;
+    for(const std::unique_ptr<Worker>& worker : workers_)
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        depths.push_back(worker->tasks.size());
+    }
+    return depths;
+}
+
+void ComputePool::threadFunc(size_t index)
+{
+    t_pool = this;
+    t_index = index;
+    while(true)
+    {
+        Functor task;
+        if(popLocal(index, task) || steal(index, task))
+        {
+            pending_.fetch_sub(1);
+            task();
+            executed_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return pending_.load() > 0 || !running_; });
+        // stop之后也要把剩下的任务执行完再退出
+        if(!running_ && pending_.load() == 0)
+        {
+            break;
+        }
+    }
+    t_pool = nullptr;
+}
+
+bool ComputePool::popLocal(size_t index, Functor& task)
+{
+    Worker& worker = *workers_[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if(worker.tasks.empty())
+    {
+        return false;
+    }
+    task = std::move(worker.tasks.front());
+    worker.tasks.pop_front();
+    return true;
+}
+
+// 从index之后的队列开始找，避免所有空闲线程都去偷同一个队列
+bool ComputePool::steal(size_t index, Functor& task)
+{
+    size_t n = workers_.size();
+    for(size_t i = 1; i < n; ++i)
+    {
+        Worker& victim = *workers_[(index + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
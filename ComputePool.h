@@ -0,0 +1,79 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Thread.h"
+#include "Task.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+
+/**
+ *  计算线程池 ComputePool
+ *  messageCallback在IO线程中执行，耗CPU的处理会拖慢同一个loop上的所有连接，
+ *  这类任务可以放到计算线程池中执行，处理结果再通过runInLoop交回连接所在的loop。
+ *  每个工作线程有自己的任务队列：工作线程自己提交的任务放进自己的队列，外部线程提交的任务轮流分给各个队列。
+ *  工作线程从自己队列的头部取任务，自己的队列空了就从其他线程队列的尾部偷一个任务(work stealing)。
+ *  需要按顺序执行的任务(比如同一个连接的消息)通过Strand提交。
+ */
+class ComputePool : noncopyable
+{
+public:
+    using Functor = Task;
+
+    explicit ComputePool(const std::string& name = std::string("ComputePool"));
+    ~ComputePool();
+
+    // 一定在start之前调用
+    void setThreadNum(int numThreads) { numThreads_ = numThreads; }
+    int threadNum() const { return numThreads_; }
+
+    void start();
+    // 执行完已经提交的任务后退出所有工作线程，之后外部线程提交的任务会被拒绝
+    void stop();
+
+    bool started() const { return running_; }
+
+    /**
+     *  线程安全，可以在任何线程中调用
+     *  线程池没有运行(还没有start或者已经stop)时返回false，task不会被移走，调用者可以换个地方执行它。
+     *  stop期间工作线程自己提交的任务(比如Strand的下一批)仍然接收
+     */
+    bool submit(Functor&& task);
+
+    // 统计信息
+    size_t queueDepth() const { return pending_.load(std::memory_order_relaxed); }   // 所有队列中等待执行的任务数
+    std::vector<size_t> queueDepths() const;    // 每个工作线程队列中的任务数
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }      // 从其他线程队列偷到的任务数
+    uint64_t executed() const { return executed_.load(std::memory_order_relaxed); }  // 已经执行完的任务数
+
+private:
+    struct Worker
+    {
+        mutable std::mutex mutex;
+        std::deque<Functor> tasks;
+    };
+
+    void threadFunc(size_t index);
+    bool popLocal(size_t index, Functor& task);
+    bool steal(size_t index, Functor& task);
+
+    std::string name_;
+    int numThreads_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::unique_ptr<Thread>> threads_;
+    std::atomic_bool running_;
+
+    std::atomic<size_t> next_;       // 外部线程提交任务时轮流选择的队列
+    std::atomic<size_t> pending_;
+    std::atomic<uint64_t> steals_;
+    std::atomic<uint64_t> executed_;
+
+    std::mutex mutex_;               // 和cond_一起让空闲的工作线程睡眠
+    std::condition_variable cond_;
+};
@@ -0,0 +1,78 @@
+#include "Coroutine.h"
+
+#include <new>
+
+namespace
+{
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+const size_t kNumClasses = CoroutineFrameAllocator::kMaxFrameSize / CoroutineFrameAllocator::kGranularity;
+
+// 当前线程的空闲帧链表，线程退出时释放
+struct FrameCache
+{
+    FreeBlock* heads[kNumClasses] = {};
+    size_t counts[kNumClasses] = {};
+
+    ~FrameCache()
+    {
+        for(size_t i = 0; i < kNumClasses; ++i)
+        {
+            while(heads[i])
+            {
+                FreeBlock* block = heads[i];
+                heads[i] = block->next;
+                ::operator delete(block);
+            }
+        }
+    }
+};
+
+thread_local FrameCache t_frameCache;
+
+size_t classOf(size_t size)
+{
+    return (size + CoroutineFrameAllocator::kGranularity - 1) / CoroutineFrameAllocator::kGranularity - 1;
+}
+}
+
+void* CoroutineFrameAllocator::allocate(size_t size)
+{
+    if(size == 0 || size > kMaxFrameSize)
+    {
+        return ::operator new(size);
+    }
+    size_t index = classOf(size);
+    FreeBlock* block = t_frameCache.heads[index];
+    if(block)
+    {
+        t_frameCache.heads[index] = block->next;
+        --t_frameCache.counts[index];
+        return block;
+    }
+    // 同一级的帧都按这一级的上限分配，才能互相复用
+    return ::operator new((index + 1) * kGranularity);
+}
+
+// 帧可能在另一个线程中释放(连接迁移之后)，放进释放线程的链表
+void CoroutineFrameAllocator::deallocate(void* frame, size_t size)
+{
+    if(size == 0 || size > kMaxFrameSize)
+    {
+        ::operator delete(frame);
+        return;
+    }
+    size_t index = classOf(size);
+    if(t_frameCache.counts[index] >= kMaxCachedPerClass)
+    {
+        ::operator delete(frame);
+        return;
+    }
+    FreeBlock* block = static_cast<FreeBlock*>(frame);
+    block->next = t_frameCache.heads[index];
+    t_frameCache.heads[index] = block;
+    ++t_frameCache.counts[index];
+}
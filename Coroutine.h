@@ -0,0 +1,214 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <stddef.h>
+
+/**
+ *  协程帧分配器
+ *  每个线程(one loop per thread，也就是每个loop)一组按大小分级的空闲链表，
+ *  协程结束时帧放回当前线程的链表，下一个协程直接复用，不经过malloc。
+ *  超过kMaxFrameSize的帧直接用operator new分配。
+ */
+class CoroutineFrameAllocator : noncopyable
+{
+public:
+    static void* allocate(size_t size);
+    static void deallocate(void* frame, size_t size);
+
+    static const size_t kGranularity = 64;
+    static const size_t kMaxFrameSize = 2048;
+    static const size_t kMaxCachedPerClass = 256;  // 每一级最多缓存的空闲帧数
+};
+
+#if defined(__cpp_impl_coroutine)
+
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "Buffer.h"
+#include "Logger.h"
+
+#include <coroutine>
+#include <string>
+#include <algorithm>
+
+/**
+ *  基于EventLoop和TcpConnection的C++20协程接口，需要用C++20编译(cmake -DDAJUNMUDUO_COROUTINE=ON)
+ *
+ *  CoTask session(TcpConnectionPtr conn)
+ *  {
+ *      while(true)
+ *      {
+ *          std::string line = co_await conn->readUntil("\r\n");
+ *          if(line.empty()) break;                         // 连接断开
+ *          if(!co_await conn->write(std::move(line))) break;
+ *      }
+ *  }
+ *  在connectionCallback中conn->connected()时调用session(conn)即可，messageCallback不需要设置。
+ *
+ *  协程在调用它的线程中立即开始执行，每次挂起都由连接所在loop的读写事件或定时器直接恢复，
+ *  不经过任务队列，也不会切换线程。协程参数里的TcpConnectionPtr保证等待期间连接不会被析构。
+ */
+
+// 不等待结果的协程，创建后立即执行，结束时自动释放帧
+class CoTask
+{
+public:
+    struct promise_type
+    {
+        CoTask get_return_object() { return CoTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception()
+        {
+            LOG_FATAL("CoTask unhandled exception\n");
+        }
+
+        static void* operator new(size_t size) { return CoroutineFrameAllocator::allocate(size); }
+        static void operator delete(void* frame, size_t size) { CoroutineFrameAllocator::deallocate(frame, size); }
+    };
+};
+
+// 读取固定长度或者读到分隔符(包含分隔符)，连接断开且数据不够时返回空字符串
+class ReadAwaiter
+{
+public:
+    ReadAwaiter(TcpConnection* conn, size_t n)
+        : conn_(conn), n_(n), length_(0)
+    {
+    }
+    ReadAwaiter(TcpConnection* conn, std::string delimiter)
+        : conn_(conn), n_(0), delimiter_(std::move(delimiter)), length_(0)
+    {
+    }
+
+    bool await_ready() { return match() || conn_->disconnected(); }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        handle_ = handle;
+        conn_->setReadWaiter([this]() { return wake(); });
+    }
+
+    std::string await_resume()
+    {
+        if(length_ == 0)
+        {
+            return std::string();
+        }
+        return conn_->inputBuffer()->retrieveAsString(length_);
+    }
+
+private:
+    // 输入缓冲区中已经有满足条件的数据时，记下要取走的长度
+    bool match()
+    {
+        Buffer* buf = conn_->inputBuffer();
+        if(delimiter_.empty())
+        {
+            length_ = n_ > 0 && buf->readableBytes() >= n_ ? n_ : 0;
+        }
+        else
+        {
+            const char* begin = buf->peek();
+            const char* end = begin + buf->readableBytes();
+            const char* pos = std::search(begin, end, delimiter_.begin(), delimiter_.end());
+            length_ = pos == end ? 0 : pos - begin + delimiter_.size();
+        }
+        return length_ > 0;
+    }
+
+    // 恢复协程之后不能再访问this，协程可能已经结束，帧被释放
+    bool wake()
+    {
+        if(!match() && !conn_->disconnected())
+        {
+            return false;
+        }
+        handle_.resume();
+        return true;
+    }
+
+    TcpConnection* conn_;
+    size_t n_;
+    std::string delimiter_;
+    size_t length_;
+    std::coroutine_handle<> handle_;
+};
+
+// 发送数据，等到输出缓冲区全部发完再恢复，返回false表示连接已经断开，或者已经shutdown、数据没有发送
+class WriteAwaiter
+{
+public:
+    WriteAwaiter(TcpConnection* conn, std::string data)
+        : conn_(conn), data_(std::move(data)), sent_(false)
+    {
+    }
+
+    bool await_ready()
+    {
+        // shutdown之后(kDisconnecting)send会丢弃数据，不能当作发送成功
+        if(!conn_->connected())
+        {
+            return true;
+        }
+        conn_->send(std::move(data_));
+        sent_ = true;
+        return conn_->pendingOutputBytes() == 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        handle_ = handle;
+        conn_->setWriteWaiter([this]() { return wake(); });
+    }
+
+    bool await_resume() { return sent_ && !conn_->disconnected(); }
+
+private:
+    bool wake()
+    {
+        if(conn_->pendingOutputBytes() > 0 && !conn_->disconnected())
+        {
+            return false;
+        }
+        handle_.resume();
+        return true;
+    }
+
+    TcpConnection* conn_;
+    std::string data_;
+    bool sent_;     // 数据是否交给了send
+    std::coroutine_handle<> handle_;
+};
+
+// 挂起seconds秒，由loop的定时器恢复
+class SleepAwaiter
+{
+public:
+    SleepAwaiter(EventLoop* loop, double seconds)
+        : loop_(loop), seconds_(seconds)
+    {
+    }
+
+    bool await_ready() const { return seconds_ <= 0; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        loop_->runAfter(seconds_, [handle]() { handle.resume(); });
+    }
+
+    void await_resume() const {}
+
+private:
+    EventLoop* loop_;
+    double seconds_;
+};
+
+inline ReadAwaiter TcpConnection::readExactly(size_t n) { return ReadAwaiter(this, n); }
+inline ReadAwaiter TcpConnection::readUntil(std::string delimiter) { return ReadAwaiter(this, std::move(delimiter)); }
+inline WriteAwaiter TcpConnection::write(std::string data) { return WriteAwaiter(this, std::move(data)); }
+inline SleepAwaiter EventLoop::sleep(double seconds) { return SleepAwaiter(this, seconds); }
+
+#endif
@@ -1,5 +1,8 @@
 #include "CurrentThread.h"
 
+#include <pthread.h>
+#include <sched.h>
+
 namespace CurrentThread
 {
     __thread int t_cachedTid = 0;
@@ -12,4 +15,26 @@ namespace CurrentThread
             t_cachedTid = static_cast<pid_t>(::syscall(SYS_gettid));
         }
     }
+
+    int setAffinity(const std::vector<int>& cpus)
+    {
+        if(cpus.empty())
+        {
+            return 0;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        return ::pthread_setaffinity_np(::pthread_self(), sizeof set, &set);
+    }
+
+    bool setLocalMemoryPolicy()
+    {
+        // glibc没有封装set_mempolicy，不依赖libnuma直接走系统调用，MPOL_LOCAL的值是4
+        const int kMpolLocal = 4;
+        return ::syscall(SYS_set_mempolicy, kMpolLocal, nullptr, 0) == 0;
+    }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <vector>
 
 namespace CurrentThread
 {
@@ -28,4 +29,11 @@ namespace CurrentThread
         }
         return t_cachedTid;
     }
+
+    //把当前线程绑定到cpus中的CPU上，cpus为空时不做任何事
+    //成功返回0，失败返回pthread_setaffinity_np的错误码(它不设置errno)
+    int setAffinity(const std::vector<int>& cpus);
+
+    //当前线程之后分配的内存优先使用本线程所在CPU的NUMA节点(MPOL_LOCAL)，失败(比如内核不支持NUMA)返回false
+    bool setLocalMemoryPolicy();
 }
\ No newline at end of file
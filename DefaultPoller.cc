@@ -1,9 +1,30 @@
 #include "Poller.h"
 #include "EPollPoller.h"
+#include "IoUringPoller.h"
+#include "Logger.h"
 
 #include <stdlib.h>
 
 Poller* Poller::newDefaultPoller(EventLoop* loop)
 {
+    // 设置了环境变量MUDUO_USE_IOURING时使用io_uring，内核不支持时退回到epoll
+    if(::getenv("MUDUO_USE_IOURING"))
+    {
+        if(IoUringPoller::isSupported())
+        {
+            // 内核支持也可能创建失败(比如RLIMIT_MEMLOCK已经被其他loop的ring用完)
+            IoUringPoller* poller = new IoUringPoller(loop);
+            if(poller->valid())
+            {
+                return poller;
+            }
+            delete poller;
+            LOG_INFO("io_uring setup failed, fall back to epoll\n");
+        }
+        else
+        {
+            LOG_INFO("io_uring is not supported by this kernel, fall back to epoll\n");
+        }
+    }
     return new EPollPoller(loop);
-}
\ No newline at end of file
+}
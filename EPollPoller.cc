@@ -6,14 +6,6 @@
 #include <unistd.h>
 #include <strings.h>
 
-//  这三个值提供给channel中的成员变量index_使用
-//  channel 未添加到poller中
-const int kNew = -1;    
-//  channel已添加到poller中
-const int kAdded = 1;
-//  channel从poller中删除
-const int kDeleted = 2;
-
 EPollPoller::EPollPoller(EventLoop* loop) : 
     Poller(loop),
     epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
@@ -32,7 +24,7 @@ EPollPoller::~EPollPoller()
 
 Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels)
 {
-    LOG_INFO("func = %s, fd total count: %lu \n", __FUNCTION__, channels_.size());
+    LOG_DEBUG("func = %s, fd total count: %lu \n", __FUNCTION__, numChannels_);
 
     int numEvents = ::epoll_wait(epollfd_, &*events_.begin(), static_cast<int>(events_.size()), timeoutMs);
     int saveErrno = errno;
@@ -40,7 +32,7 @@ Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels)
 
     if(numEvents > 0)
     {
-        LOG_INFO("%d events happened \n", numEvents);
+        LOG_DEBUG("%d events happened \n", numEvents);
         fillActiveChannels(numEvents, activeChannels);
         if(numEvents == events_.size())
         {
@@ -67,31 +59,37 @@ Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels)
 
     void EPollPoller::updateChannel(Channel* channel)
     {
-        const int index = channel->index();
-        LOG_INFO("func = %s, fd = %d, events = %d, index = %d \n"
-            , __FUNCTION__, channel->fd(), channel->events(), index);
+        int fd = channel->fd();
+        ChannelSlot& slot = slotOf(fd);
+        LOG_INFO("func = %s, fd = %d, events = %d, state = %d \n"
+            , __FUNCTION__, fd, channel->events(), slot.state);
         
-        if(index == kNew || index == kDeleted)
+        if(slot.state == kNew || slot.state == kDeleted)
         {
-            if(index == kNew)
+            if(slot.state == kNew)
             {
-                int fd = channel->fd();
-                channels_[fd] = channel;
+                slot.channel = channel;
+                ++numChannels_;
+            }
+            else if(channel->isNoneEvent())
+            {
+                return;     //已经从epoll中删除，仍然不关注任何事件
             }
 
-            channel->set_index(kAdded);
+            slot.state = kAdded;
+            slot.events = interestOf(channel);
             update(EPOLL_CTL_ADD, channel);
         }
         else    //channel已经在poller上注册过了
         {
-            int fd = channel->fd();
             if(channel->isNoneEvent())
             {
                 update(EPOLL_CTL_DEL, channel);
-                channel->set_index(kDeleted);
+                slot.state = kDeleted;
             }
-            else
+            else if(slot.events != interestOf(channel))
             {
+                slot.events = interestOf(channel);
                 update(EPOLL_CTL_MOD, channel);
             }
         }
@@ -101,16 +99,21 @@ Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels)
     void EPollPoller::removeChannel(Channel* channel)
     {   
         int fd = channel->fd();
-        channels_.erase(fd);
+        ChannelSlot& slot = slotOf(fd);
 
         LOG_INFO("func = %s, fd = %d\n", __FUNCTION__, fd);
 
-        int index = channel->index();
-        if(index == kAdded)
+        int state = slot.state;
+        if(slot.channel == channel)
+        {
+            slot.channel = nullptr;
+            --numChannels_;
+        }
+        slot.state = kNew;
+        if(state == kAdded)
         {
             update(EPOLL_CTL_DEL, channel);
         }
-        channel->set_index(kNew);
     }
 
     //填写活跃的连接
@@ -133,6 +136,10 @@ Timestamp EPollPoller::poll(int timeoutMs, ChannelList* activeChannels)
         
         int fd = channel->fd();
         event.events = channel->events();
+        if(channel->edgeTriggered())
+        {
+            event.events |= EPOLLET;
+        }
         event.data.ptr = channel;
 
         if(epoll_ctl(epollfd_, operation, fd, &event) < 0)
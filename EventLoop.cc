@@ -2,11 +2,16 @@
 #include "Logger.h"
 #include "Poller.h"
 #include "Channel.h"
+#include "TimerQueue.h"
+#include "TimingWheel.h"
+#include "BufferPool.h"
 
 #include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <algorithm>
 
 // 防止一个线程创建多个EventLoop  thread_local
 __thread EventLoop *t_loopInThisThread = nullptr;
@@ -39,7 +44,23 @@ EventLoop::EventLoop() :
     threadId_(CurrentThread::tid()),
     poller_(Poller::newDefaultPoller(this)),
     wakeupFd_(createEventfd()),
-    wakeupChannel_(new Channel(this, wakeupFd_))
+    wakeupChannel_(new Channel(this, wakeupFd_)),
+    timerQueue_(new TimerQueue(this)),
+    spinMicros_(0),
+    sockBusyPollMicros_(0),
+    spinning_(false),
+    spins_(0),
+    spinHits_(0),
+    spinMicrosSpent_(0),
+    numConnections_(0),
+    queuedFunctors_(0),
+    busyRatio_(0.0),
+    busyPermille_(0),
+    bufferPool_(BufferPool::current()),
+    lastBufferTrim_(0),
+    pendingHead_(nullptr),
+    nodePool_(new PendingNode[kNodePoolSize]),
+    freeHead_(0)
 {
     LOG_DEBUG("EventLoop create %p in thread %d\n", this, threadId_);
     if(t_loopInThisThread)
@@ -51,6 +72,13 @@ EventLoop::EventLoop() :
         t_loopInThisThread = this;
     }
 
+    // 把所有节点串成空闲链表
+    for(uint32_t i = 0; i < kNodePoolSize; ++i)
+    {
+        nodePool_[i].freeNext.store(i + 1 < kNodePoolSize ? i + 2 : 0, std::memory_order_relaxed);
+    }
+    freeHead_.store(1, std::memory_order_release);
+
     // 设置wakeupfd的事件类型以及发生事件后的回调操作
     wakeupChannel_->setReadCallback(std::bind(&EventLoop::handleRead, this));
     //每一个EventLoop都将监听wakeupchannel的EPOLLIN读事件
@@ -63,6 +91,23 @@ EventLoop::~EventLoop()
     wakeupChannel_->remove();
     ::close(wakeupFd_);
     t_loopInThisThread = nullptr;
+
+    // 释放loop退出后还没来得及执行的回调
+    PendingNode* node = pendingHead_.exchange(nullptr);
+    while(node != nullptr)
+    {
+        PendingNode* next = node->next;
+        freeNode(node);
+        node = next;
+    }
+}
+
+// 单调时钟，微秒
+static int64_t nowMicros()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
 }
 
 // 开启事件循环
@@ -72,11 +117,23 @@ void EventLoop::loop()
     quit_ = false;
     LOG_INFO("EventLoop %p start looping \n", this);
 
+    int64_t iterationStart = nowMicros();
     while(!quit_)
     {
         activeChannels_.clear();
-        // 监听两类fd    一种是client的fd，一种是wakeupfd
-        pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
+        if(spinMicros_ > 0)
+        {
+            busyPoll();
+        }
+        if(activeChannels_.empty() && !quit_)
+        {
+            // 忙轮询阶段没有等到事件，并且没有待执行的回调，才阻塞等待
+            int timeoutMs = pendingHead_.load() != nullptr ? 0 : kPollTimeMs;
+            flushChannelUpdates();
+            // 监听两类fd    一种是client的fd，一种是wakeupfd
+            pollReturnTime_ = poller_->poll(timeoutMs, &activeChannels_);
+        }
+        int64_t pollEnd = nowMicros();
         for(Channel* channel : activeChannels_)
         {
             //Poller监听哪些channel发生事件了，然后上报给EventLoop，通知channel处理相应的事件
@@ -88,11 +145,88 @@ void EventLoop::loop()
          *  唤醒(wakeup) subLoop后，执行下面的方法，执行之前mainLoop注册的cb操作
          */
         doPengingFunctors();
+
+        int64_t iterationEnd = nowMicros();
+        updateBusyPermille(iterationEnd - pollEnd, iterationEnd - iterationStart);
+        iterationStart = iterationEnd;
+
+        // 空闲时poll最多阻塞kPollTimeMs，所以持续空闲的loop也会定期走到这里
+        if(iterationEnd - lastBufferTrim_ >= kBufferTrimIntervalMicros)
+        {
+            bufferPool_->trim();
+            lastBufferTrim_ = iterationEnd;
+        }
     }
     LOG_INFO("EventLoop %p stop looping. \n", this);
     looping_ = false;
 }
 
+/**
+ *  忙轮询  以超时0调用poll，不会让线程睡眠，省掉了epoll_wait睡眠和被唤醒的开销
+ *  spinning_为true期间，queueInLoop不写eventfd，这里每轮都会检查并执行pendingFunctors。
+ *  退出前先清除spinning_再检查一次队列(loop()中阻塞之前)，和queueInLoop中先入队再读spinning_配合，
+ *  保证不会有回调在loop阻塞时被遗漏
+ */
+void EventLoop::busyPoll()
+{
+    int64_t start = nowMicros();
+    spinning_ = true;
+    while(!quit_)
+    {
+        flushChannelUpdates();
+        pollReturnTime_ = poller_->poll(0, &activeChannels_);
+        ++spins_;
+        if(!activeChannels_.empty())
+        {
+            ++spinHits_;
+            break;
+        }
+        if(pendingHead_.load() != nullptr)
+        {
+            doPengingFunctors();
+        }
+        if(nowMicros() - start >= spinMicros_)
+        {
+            break;
+        }
+    }
+    spinning_ = false;
+    spinMicrosSpent_ += nowMicros() - start;
+}
+
+/**
+ *  按时间加权的指数平均，一次迭代的权重是它的时长占kBusyWindowMicros的比例，
+ *  很多次很短的迭代和一次长时间阻塞的poll得到的结果一致
+ *  只有loop线程写，其他线程只读，不需要原子的读-改-写
+ */
+void EventLoop::updateBusyPermille(int64_t busyMicros, int64_t totalMicros)
+{
+    if(totalMicros <= 0)
+    {
+        return;
+    }
+    double sample = static_cast<double>(busyMicros) / totalMicros;
+    double weight = totalMicros >= kBusyWindowMicros ? 1.0 : static_cast<double>(totalMicros) / kBusyWindowMicros;
+    busyRatio_ += (sample - busyRatio_) * weight;
+    busyPermille_.store(static_cast<int>(busyRatio_ * 1000), std::memory_order_relaxed);
+}
+
+int64_t EventLoop::bufferBytes() const
+{
+    return bufferPool_->bytesInUse();
+}
+
+int64_t EventLoop::bufferPoolBytes() const
+{
+    return bufferPool_->bytesCached();
+}
+
+void EventLoop::setBusyPoll(int spinMicros, int sockBusyPollMicros)
+{
+    spinMicros_ = spinMicros > 0 ? spinMicros : 0;
+    sockBusyPollMicros_ = spinMicros > 0 ? sockBusyPollMicros : 0;
+}
+
 //  退出事件循环    1. loop在自己的线程中调用quit   2. 在非loop的线程中，调用loop的quit
 void EventLoop::quit()
 {
@@ -114,27 +248,113 @@ void EventLoop::runInLoop(Functor cb)
     }
     else    //  在非当前loop线程中执行cb，就需要唤醒loop所在线程，执行cb
     {
-        queueInLoop(cb);    
+        queueInLoop(std::move(cb));
     }
 }
 
 //  把cb放入队列中，唤醒loop所在的线程，执行cb
 void EventLoop::queueInLoop(Functor cb)
 {
+    PendingNode* node = allocNode();
+    node->functor = std::move(cb);
+    queuedFunctors_.fetch_add(1, std::memory_order_relaxed);
+    PendingNode* head = pendingHead_.load(std::memory_order_relaxed);
+    do
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        pendingFunctors_.emplace_back(cb);
-    }
+        node->next = head;
+    } while(!pendingHead_.compare_exchange_weak(head, node,
+                std::memory_order_seq_cst, std::memory_order_relaxed));
+
     /**
      *  唤醒相应的，需要执行上面回调操作的loop线程了
-     *      || callingPendingFunctors_的意思是：当前loop正在执行回调，但是loop又有了新的回调 
+     *      || callingPendingFunctors_的意思是：当前loop正在执行回调，但是loop又有了新的回调
+     *  只有队列从空变为非空的那个生产者需要唤醒：队列非空说明之前已经有人唤醒过loop，
+     *  loop被唤醒后会一次取走包括本节点在内的整条链表，这样并发投递时多次eventfd写合并成了一次
+     *  loop正在忙轮询时不会睡眠，也不需要唤醒
      */
-    if(!isInLoopThread() || callingPengingFunctors_)
+    if(head == nullptr && (!isInLoopThread() || callingPengingFunctors_) && !spinning_)
     {
         wakeup();   // 唤醒loop所在线程
     }
 }
 
+void EventLoop::runAtIterationEnd(Functor cb)
+{
+    iterationEndFunctors_.push_back(std::move(cb));
+}
+
+TimerId EventLoop::runAt(Timestamp time, TimerCallback cb)
+{
+    return timerQueue_->addTimer(std::move(cb), time, 0.0);
+}
+
+TimerId EventLoop::runAfter(double delay, TimerCallback cb)
+{
+    Timestamp time(addTime(Timestamp::now(), delay));
+    return runAt(time, std::move(cb));
+}
+
+TimerId EventLoop::runEvery(double interval, TimerCallback cb)
+{
+    Timestamp time(addTime(Timestamp::now(), interval));
+    return timerQueue_->addTimer(std::move(cb), time, interval);
+}
+
+void EventLoop::cancel(TimerId timerId)
+{
+    timerQueue_->cancel(timerId);
+}
+
+TimingWheel* EventLoop::timingWheel()
+{
+    if(!timingWheel_)
+    {
+        timingWheel_.reset(new TimingWheel(this));
+    }
+    return timingWheel_.get();
+}
+
+EventLoop::PendingNode* EventLoop::allocNode()
+{
+    uint64_t head = freeHead_.load(std::memory_order_acquire);
+    while(true)
+    {
+        uint32_t index = static_cast<uint32_t>(head);
+        if(index == 0)
+        {
+            // 节点池用完了
+            return new PendingNode();
+        }
+        PendingNode* node = &nodePool_[index - 1];
+        uint64_t newHead = ((head >> 32) + 1) << 32 | node->freeNext.load(std::memory_order_relaxed);
+        if(freeHead_.compare_exchange_weak(head, newHead,
+                std::memory_order_acquire, std::memory_order_acquire))
+        {
+            return node;
+        }
+    }
+}
+
+void EventLoop::freeNode(PendingNode* node)
+{
+    node->functor = nullptr;    // 释放任务持有的资源(比如TcpConnectionPtr)
+    if(node < nodePool_.get() || node >= nodePool_.get() + kNodePoolSize)
+    {
+        delete node;
+        return;
+    }
+
+    uint32_t index = static_cast<uint32_t>(node - nodePool_.get()) + 1;
+    uint64_t head = freeHead_.load(std::memory_order_relaxed);
+    uint64_t newHead;
+    do
+    {
+        node->freeNext.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        newHead = ((head >> 32) + 1) << 32 | index;
+    } while(!freeHead_.compare_exchange_weak(head, newHead,
+                std::memory_order_release, std::memory_order_relaxed));
+}
+
 void EventLoop::handleRead()
 {
     uint64_t one = 1;
@@ -158,14 +378,35 @@ void EventLoop::wakeup()
 
 void EventLoop::updateChannel(Channel* channel)
 {
-    poller_->updateChannel(channel);
+    if(!channel->dirty())
+    {
+        channel->setDirty(true);
+        dirtyChannels_.push_back(channel);
+    }
 }
 
 void EventLoop::removeChannel(Channel* channel)
 {
+    // 还没提交的修改直接丢弃，channel删除之后可能马上被析构，不能留在dirty列表里
+    if(channel->dirty())
+    {
+        channel->setDirty(false);
+        dirtyChannels_.erase(std::find(dirtyChannels_.begin(), dirtyChannels_.end(), channel));
+    }
     poller_->removeChannel(channel);
 }
 
+// 每个channel只按最终的events提交一次，poller会跳过和内核中已注册的事件相同的更新
+void EventLoop::flushChannelUpdates()
+{
+    for(Channel* channel : dirtyChannels_)
+    {
+        channel->setDirty(false);
+        poller_->updateChannel(channel);
+    }
+    dirtyChannels_.clear();
+}
+
 bool EventLoop::hasChannel(Channel *channel)
 {
     return poller_->hasChannel(channel);
@@ -173,25 +414,52 @@ bool EventLoop::hasChannel(Channel *channel)
 
 // 执行回调
 /**
- *  1. 不是简单的在临界区内依次调用functor，而是把回调列表swap到functors中，这一方面减小了临界区的长度，
- *     意味着不会阻塞其他线程的queueInLoop()，另一方面也避免了死锁(因为Functor可能再次调用queueInLoop)
+ *  1. 不是边取边调用functor，而是用一次原子exchange把整条回调链表取到functors中，不会阻塞其他线程的queueInLoop()，
+ *     也避免了Functor再次调用queueInLoop时修改正在遍历的链表
  *  2. 由于doPendingFunctors()调用的Functor可能再次调用queueInLoop(cb)，这时queueInLoop()就必须wakeup(),
  *     否则新增的cb可能就不能及时调用了
  *  3. muduo没有反复执行doPendingFunctors()直到pendingFunctors为空，这是有意的，否则I/O线程可能陷入死循环，无法处理I/O事件
  */
 void EventLoop::doPengingFunctors()
 {
-    std::vector<Functor> functors;
     callingPengingFunctors_ = true;
 
+    // 一次取走所有节点，之后新加入的回调留到下一轮执行
+    PendingNode* node = pendingHead_.exchange(nullptr, std::memory_order_acquire);
+
+    // 链表头是最后加入的节点，反转成加入的顺序
+    PendingNode* functors = nullptr;
+    while(node != nullptr)
+    {
+        PendingNode* next = node->next;
+        node->next = functors;
+        functors = node;
+        node = next;
+    }
+
+    int count = 0;
+    while(functors != nullptr)
+    {
+        functors->functor(); //执行当前loop需要执行的回调操作
+        PendingNode* next = functors->next;
+        freeNode(functors);
+        functors = next;
+        ++count;
+    }
+    if(count > 0)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        functors.swap(pendingFunctors_);
+        queuedFunctors_.fetch_sub(count, std::memory_order_relaxed);
     }
 
-    for(const Functor& functor : functors)
+    // 事件处理和回调中积攒的操作(比如cork住的发送)在这里统一执行，执行时新加入的也在这一轮执行
+    while(!iterationEndFunctors_.empty())
     {
-        functor(); //执行当前loop需要执行的回调操作
+        std::vector<Functor> functors;
+        functors.swap(iterationEndFunctors_);
+        for(Functor& functor : functors)
+        {
+            functor();
+        }
     }
 
     callingPengingFunctors_ = false;
@@ -4,14 +4,20 @@
 #include <vector>
 #include <atomic>
 #include <memory>
-#include <mutex>
 
 #include "noncopyable.h"
 #include "Timestamp.h"
 #include "CurrentThread.h"
+#include "Callbacks.h"
+#include "TimerId.h"
+#include "Task.h"
 
 class Channel;
 class Poller;
+class TimerQueue;
+class TimingWheel;
+class SleepAwaiter;
+class BufferPool;
 
 //事件循环类    主要包含两个大模块 Channel  Poller (epoll的抽象)
 /** EventLoop主要功能
@@ -25,7 +31,8 @@ class Poller;
 class EventLoop : noncopyable
 {
 public:
-    using Functor = std::function<void()>;
+    // 只能移动、带内联存储的任务类型，投递常见的std::bind任务时不分配内存
+    using Functor = Task;
     EventLoop();
     ~EventLoop();
 
@@ -36,15 +43,74 @@ public:
 
     Timestamp pollReturnTime() const { return pollReturnTime_; }
 
+    /**
+     *  忙轮询模式 给延迟敏感的服务用一个CPU核换取更低的唤醒延迟
+     *  spinMicros > 0 时，loop先以超时0反复调用poll()，每两次poll之间执行pendingFunctors，
+     *  连续spinMicros微秒都没有事件才退回到阻塞的poll；每次有事件都会重新开始计时
+     *  sockBusyPollMicros > 0 时，这个loop上建立的连接会设置SO_BUSY_POLL(可能需要CAP_NET_ADMIN)
+     *  spinMicros == 0 关闭忙轮询。在loop()之前或者loop所在的线程中调用
+     */
+    void setBusyPoll(int spinMicros, int sockBusyPollMicros = 50);
+    int busyPollMicros() const { return spinMicros_; }
+    int sockBusyPollMicros() const { return sockBusyPollMicros_; }
+
+    // 忙轮询的统计数据，可以跨线程读取，用来按部署环境调整spinMicros
+    uint64_t busyPollSpins() const { return spins_; }          // 超时为0的poll调用次数
+    uint64_t busyPollHits() const { return spinHits_; }        // 其中返回了事件的次数，hits/spins即命中率
+    uint64_t busyPollMicrosSpent() const { return spinMicrosSpent_; }  // 花在忙轮询上的总时间
+
+    /**
+     *  负载统计，都是原子变量，EventLoopThreadPool分配新连接时跨线程读取
+     *  numConnections  分配到这个loop上还没有销毁的连接数
+     *  queuedFunctors  已经投递还没有执行的回调数
+     *  busyPermille    loop处理事件和回调所占的时间比例(千分比)，按迭代做指数加权平均
+     */
+    int numConnections() const { return numConnections_.load(std::memory_order_relaxed); }
+    void addConnections(int delta) { numConnections_.fetch_add(delta, std::memory_order_relaxed); }
+    int queuedFunctors() const { return queuedFunctors_.load(std::memory_order_relaxed); }
+    int busyPermille() const { return busyPermille_.load(std::memory_order_relaxed); }
+    int load() const { return busyPermille() + queuedFunctors(); }
+
+    /**
+     *  缓冲区内存统计，可以跨线程读取，见BufferPool
+     *  bufferBytes      这个loop线程分配、还在各个Buffer中的字节数
+     *  bufferPoolBytes  这个loop的BufferPool中缓存的空闲字节数，持续空闲kBufferTrimIntervalMicros后逐步释放
+     */
+    int64_t bufferBytes() const;
+    int64_t bufferPoolBytes() const;
+
     // 在当前loop中执行cb
     void runInLoop(Functor cb);
     // 把cb放入队列中，唤醒loop所在的线程，执行cb
     void queueInLoop(Functor cb);
+    // 在本轮循环处理完活跃事件和回调之后执行cb，只能在loop所在的线程中调用，TcpConnection的自动cork用它合并发送
+    void runAtIterationEnd(Functor cb);
+
+    // 定时器  可以跨线程调用，回调总是在loop所在的线程中执行
+    // 在time时刻执行cb
+    TimerId runAt(Timestamp time, TimerCallback cb);
+    // delay秒之后执行cb
+    TimerId runAfter(double delay, TimerCallback cb);
+    // 每隔interval秒执行一次cb
+    TimerId runEvery(double interval, TimerCallback cb);
+    // 取消定时器
+    void cancel(TimerId timerId);
+#if defined(__cpp_impl_coroutine)
+    // co_await loop->sleep(seconds)，定义在Coroutine.h中，只能在loop线程中的协程里使用
+    SleepAwaiter sleep(double seconds);
+#endif
+
+    // 本loop的时间轮，第一次使用时创建，只能在loop所在的线程中调用
+    TimingWheel* timingWheel();
 
     //用来唤醒loop所在的线程
     void wakeup();
 
-    //供Channel中调用的接口，通过EventLoop调用Poller的方法
+    /**
+     *  供Channel中调用的接口，通过EventLoop调用Poller的方法
+     *  updateChannel只是把channel记为dirty，同一轮循环中的多次修改在下一次poll之前合并提交一次，
+     *  相互抵消的修改(比如enableWriting后又disableWriting)不会产生epoll_ctl
+     */
     void updateChannel(Channel* channel);
     void removeChannel(Channel* channel);
     bool hasChannel(Channel* channel);
@@ -54,6 +120,9 @@ public:
 private:
     void handleRead(); //将事件通知描述符里的内容读走，以便让其继续检测事件通知
     void doPengingFunctors(); //执行回调    执行转交给I/O的任务
+    void busyPoll();    //忙轮询，直到有事件、超过spinMicros_或者loop退出
+    void flushChannelUpdates();    //把dirty的channel提交给poller
+    void updateBusyPermille(int64_t busyMicros, int64_t totalMicros);
 
     using ChannelList = std::vector<Channel*>;  // 事件分发器列表
 
@@ -64,16 +133,59 @@ private:
 
     Timestamp pollReturnTime_;  //poller返回发生事件的channels的时间点 poll阻塞的时间
 
+    ChannelList activeChannels_;    //活跃的事件集
+    ChannelList dirtyChannels_;     //关注事件变化了、还没有提交给poller的channel，要在timerQueue_之前构造
+
     std::unique_ptr<Poller> poller_;
 
     int wakeupFd_;  //当mainLoop获取一个新用户的channel，通过轮询算法选择一个subloop，通过wakeupFd_唤醒subloop处理channel
     std::unique_ptr<Channel> wakeupChannel_;
 
-    ChannelList activeChannels_;    //活跃的事件集
+    std::unique_ptr<TimerQueue> timerQueue_;    //定时器队列，通过timerfd接入Poller
+    std::unique_ptr<TimingWheel> timingWheel_;  //时间轮，管理大量连接的超时，由timerQueue_驱动
 
     std::atomic_bool callingPengingFunctors_;   //标识当前loop是否有需要执行的回调操作
-
-    std::vector<Functor> pendingFunctors_;      //存储loop需要执行的所有回调操作
-    
-    std::mutex mutex_;  //互斥锁，用来保护上面vector容器的线程安全操作
+    std::vector<Functor> iterationEndFunctors_; //本轮循环末尾执行的回调，只在loop线程中访问
+
+    std::atomic_int spinMicros_;            //忙轮询的时间窗口，0表示不开启
+    std::atomic_int sockBusyPollMicros_;    //连接socket的SO_BUSY_POLL
+    std::atomic_bool spinning_;             //loop正在忙轮询，此时queueInLoop不需要写eventfd
+    std::atomic<uint64_t> spins_;
+    std::atomic<uint64_t> spinHits_;
+    std::atomic<uint64_t> spinMicrosSpent_;
+
+    std::atomic_int numConnections_;
+    std::atomic_int queuedFunctors_;
+    static const int64_t kBusyWindowMicros = 100 * 1000;   // busyPermille_的平均时间窗口
+    double busyRatio_;              // loop线程内部的精确值
+    std::atomic_int busyPermille_;  // 对外发布的千分比
+
+    BufferPool* bufferPool_;        // loop线程的缓冲区内存池
+    static const int64_t kBufferTrimIntervalMicros = 10 * 1000 * 1000;
+    int64_t lastBufferTrim_;
+
+    /**
+     *  存储loop需要执行的所有回调操作  侵入式的无锁多生产者单消费者队列
+     *  生产者用CAS把节点压到链表头部，loop线程用一次exchange取走整条链表再反转成FIFO顺序执行，
+     *  和原来加锁swap一个vector的语义相同，但生产者之间、生产者和loop线程之间都不再竞争互斥锁
+     */
+    struct PendingNode
+    {
+        Functor functor;
+        PendingNode* next;                  //待执行链表中的下一个节点
+        std::atomic<uint32_t> freeNext;     //空闲链表中下一个节点的下标+1，0表示链表尾
+    };
+    std::atomic<PendingNode*> pendingHead_;
+
+    /**
+     *  PendingNode节点池，稳定状态下queueInLoop不分配内存
+     *  空闲链表同样是无锁栈，多个生产者并发取节点，loop线程归还节点；
+     *  头部高32位是版本号，每次修改都加1，防止ABA问题。池子用完时退回到new/delete
+     */
+    static const uint32_t kNodePoolSize = 1024;
+    PendingNode* allocNode();
+    void freeNode(PendingNode* node);
+
+    std::unique_ptr<PendingNode[]> nodePool_;
+    std::atomic<uint64_t> freeHead_;    //高32位版本号，低32位空闲节点下标+1
 };
\ No newline at end of file
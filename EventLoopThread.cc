@@ -1,5 +1,6 @@
 #include "EventLoopThread.h"
 #include "EventLoop.h"
+#include "Logger.h"
 
 EventLoopThread::EventLoopThread(const ThreadInitCallback &cb,
         const std::string& name)
@@ -8,7 +9,8 @@ EventLoopThread::EventLoopThread(const ThreadInitCallback &cb,
           thread_(std::bind(&EventLoopThread::threadFunc, this), name),
           mutex_(),
           cond_(),
-          callback_(cb)
+          callback_(cb),
+          localMemory_(false)
 {
 }
 
@@ -42,6 +44,17 @@ EventLoop* EventLoopThread::startLoop()
 //  在单独新线程中运行的函数
 void EventLoopThread::threadFunc()
 {
+    // 先绑核再创建EventLoop，loop的poller、任务节点池等都分配在这个CPU所在的NUMA节点上
+    int err = CurrentThread::setAffinity(cpus_);
+    if(err != 0)
+    {
+        LOG_INFO("EventLoopThread %s set cpu affinity failed, error = %d\n", thread_.name().c_str(), err);
+    }
+    if(localMemory_ && !CurrentThread::setLocalMemoryPolicy())
+    {
+        LOG_INFO("EventLoopThread %s set local memory policy failed, errno = %d\n", thread_.name().c_str(), errno);
+    }
+
     EventLoop loop; //创建一个独立的EventLoop，和线程一一对应
 
     if(callback_)
@@ -7,6 +7,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <string>
+#include <vector>
 
 class EventLoop;
 
@@ -23,6 +24,13 @@ public:
         const std::string &name = std::string());
     ~EventLoopThread();
 
+    // 在startLoop之前调用：线程启动后、创建EventLoop之前绑定到cpus，localMemory为true时使用本地NUMA节点分配内存
+    void setCpuAffinity(const std::vector<int>& cpus, bool localMemory)
+    {
+        cpus_ = cpus;
+        localMemory_ = localMemory;
+    }
+
     EventLoop* startLoop();
 
 private:
@@ -34,6 +42,8 @@ private:
     std::mutex mutex_;
     std::condition_variable cond_;
     ThreadInitCallback callback_;
+    std::vector<int> cpus_;
+    bool localMemory_;
 };
 
 
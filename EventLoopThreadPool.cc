@@ -1,12 +1,21 @@
 #include "EventLoopThreadPool.h"
 #include "EventLoopThread.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "CurrentThread.h"
+#include "Logger.h"
+
+#include <errno.h>
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop, const std::string& nameArg)
     : baseLoop_(baseLoop),
       name_(nameArg),
       started_(false),
       numThreads_(0),
-      next_(0)
+      next_(0),
+      policy_(kRoundRobin),
+      seed_(2463534242u),
+      numaLocal_(false)
 {
 
 }
@@ -20,11 +29,23 @@ EventLoopThreadPool::~EventLoopThreadPool()
 void EventLoopThreadPool::start(const ThreadInitCallback& cb)
 {
     started_ = true;
+    // baseLoop就运行在调用start的线程中
+    int err = CurrentThread::setAffinity(baseCpuSet_);
+    if(err != 0)
+    {
+        LOG_INFO("EventLoopThreadPool %s set base loop cpu affinity failed, error = %d\n", name_.c_str(), err);
+    }
+    if(numaLocal_ && !CurrentThread::setLocalMemoryPolicy())
+    {
+        LOG_INFO("EventLoopThreadPool %s set local memory policy failed, errno = %d\n", name_.c_str(), errno);
+    }
+
     for(int i = 0; i < numThreads_; ++i)
     {
         char buf[name_.size() + 32];
         snprintf(buf, sizeof buf, "%s%d", name_.c_str(), i);
         EventLoopThread* t = new EventLoopThread(cb, buf);
+        t->setCpuAffinity(loopCpuSet(i), numaLocal_);
         threads_.push_back(std::unique_ptr<EventLoopThread>(t));
         // 底层创建线程，绑定一个新的EventLoop，并返回该loop的地址
         loops_.push_back(t->startLoop());
@@ -55,6 +76,76 @@ EventLoop* EventLoopThreadPool::getNextLoop()
     return loop;
 }
 
+EventLoop* EventLoopThreadPool::getLoopForConnection(const InetAddress& peerAddr)
+{
+    if(loops_.empty())
+    {
+        return baseLoop_;
+    }
+    if(placementCallback_)
+    {
+        return placementCallback_(loops_, peerAddr);
+    }
+
+    switch(policy_)
+    {
+    case kLeastConnections:
+    {
+        EventLoop* loop = loops_[0];
+        for(EventLoop* candidate : loops_)
+        {
+            if(candidate->numConnections() < loop->numConnections())
+            {
+                loop = candidate;
+            }
+        }
+        return loop;
+    }
+    case kPowerOfTwoChoices:
+    {
+        if(loops_.size() == 1)
+        {
+            return loops_[0];
+        }
+        // xorshift32
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        size_t i = seed_ % loops_.size();
+        size_t j = (i + 1 + (seed_ >> 16) % (loops_.size() - 1)) % loops_.size();
+        EventLoop* a = loops_[i];
+        EventLoop* b = loops_[j];
+        int loadA = a->load();
+        int loadB = b->load();
+        if(loadA != loadB)
+        {
+            return loadA < loadB ? a : b;
+        }
+        return a->numConnections() <= b->numConnections() ? a : b;
+    }
+    case kHashByPeer:
+    {
+        // 只用IP不用端口，同一台客户端机器的连接落在同一个loop上
+        // 乘法哈希的高位和IP的每一位都有关
+        uint32_t ip = ntohl(peerAddr.getSockAddr()->sin_addr.s_addr);
+        uint32_t hash = (ip * 2654435761u) >> 16;
+        return loops_[hash % loops_.size()];
+    }
+    case kRoundRobin:
+    default:
+        return getNextLoop();
+    }
+}
+
+EventLoopThreadPool::CpuSet EventLoopThreadPool::loopCpuSet(size_t index) const
+{
+    if(numThreads_ == 0)
+    {
+        return baseCpuSet_;
+    }
+    return cpuSets_.empty() ? CpuSet() : cpuSets_[index % cpuSets_.size()];
+}
+
 std::vector<EventLoop*> EventLoopThreadPool::getAllLoops()
 {
     if(loops_.empty())
@@ -5,9 +5,11 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <stdint.h>
 
 class EventLoop;
 class EventLoopThread;
+class InetAddress;
 
 /**
  *      线程池类 EventLoopThreadPool
@@ -21,16 +23,54 @@ class EventLoopThreadPool : noncopyable
 {
 public:
     using ThreadInitCallback = std::function<void(EventLoop*)>;
+    // 自定义的分配策略，从loops中为peerAddr的新连接选一个loop
+    using PlacementCallback = std::function<EventLoop*(const std::vector<EventLoop*>& loops, const InetAddress& peerAddr)>;
+
+    /**
+     *  新连接分配到哪个subloop
+     *  kRoundRobin         轮询，默认
+     *  kLeastConnections   连接数最少的loop
+     *  kPowerOfTwoChoices  随机取两个loop，选负载(EventLoop::load()，忙碌比例+排队的回调数)低的那个，
+     *                      负载相同时选连接少的。只看两个loop，不会让所有新连接都涌向同一个刚刚空闲的loop
+     *  kHashByPeer         按客户端IP哈希，同一个客户端的连接总是在同一个loop上
+     */
+    enum PlacementPolicy
+    {
+        kRoundRobin,
+        kLeastConnections,
+        kPowerOfTwoChoices,
+        kHashByPeer,
+    };
+
     EventLoopThreadPool(EventLoop* baseLoop, const std::string& nameArg);
     ~EventLoopThreadPool();
 
     void setThreadNum(int numThreads) { numThreads_ = numThreads; }
 
+    /**
+     *  CPU亲和性和NUMA，都在start之前调用
+     *  第i个subloop线程绑定到cpuSets[i % cpuSets.size()]，baseLoop绑定到setBaseLoopCpuSet给出的CPU(start时绑定调用线程)。
+     *  numaLocal为true时，每个loop线程绑核之后设置MPOL_LOCAL，再创建EventLoop，
+     *  loop自己的数据结构和之后在这个线程里分配的连接、缓冲区都落在本地NUMA节点上
+     */
+    using CpuSet = std::vector<int>;
+    void setThreadCpuSets(const std::vector<CpuSet>& cpuSets) { cpuSets_ = cpuSets; }
+    void setBaseLoopCpuSet(const CpuSet& cpus) { baseCpuSet_ = cpus; }
+    void setNumaLocal(bool on) { numaLocal_ = on; }
+    bool numaLocal() const { return numaLocal_; }
+    // 第index个loop(和getAllLoops()的顺序相同)绑定的CPU，没有绑定时为空
+    CpuSet loopCpuSet(size_t index) const;
+
     void start(const ThreadInitCallback& cb = ThreadInitCallback());
 
     // 如果工作在多线程中，baseLoop_默认以轮询的方式分配channel给subloop
     EventLoop* getNextLoop();
 
+    // 按分配策略给新连接选择loop，只在baseLoop线程中调用
+    void setPlacementPolicy(PlacementPolicy policy) { policy_ = policy; }
+    void setPlacementCallback(const PlacementCallback& cb) { placementCallback_ = cb; }
+    EventLoop* getLoopForConnection(const InetAddress& peerAddr);
+
     std::vector<EventLoop*> getAllLoops();
 
     bool started() const { return started_; }
@@ -42,6 +82,12 @@ private:
     bool started_;          // 是否开始，在start()函数中被赋值为true
     int numThreads_;        // 线程数量
     int next_;              // 新连接到来时，所选择的EventLoop对象下标
+    PlacementPolicy policy_;
+    PlacementCallback placementCallback_;   // 设置之后优先于policy_
+    uint32_t seed_;         // kPowerOfTwoChoices用的xorshift随机数状态
+    std::vector<CpuSet> cpuSets_;
+    CpuSet baseCpuSet_;
+    bool numaLocal_;
     std::vector<std::unique_ptr<EventLoopThread>> threads_;     // IO线程列表
     std::vector<EventLoop*> loops_;     // EventLoop列表
 };
\ No newline at end of file
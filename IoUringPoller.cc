@@ -0,0 +1,393 @@
+#include "IoUringPoller.h"
+#include "Logger.h"
+#include "Channel.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+//  POLL_REMOVE请求自身的user_data，它的CQE直接忽略；有效的user_data中generation从1开始，不会为0
+const uint64_t kIgnoreUserData = 0;
+
+static int io_uring_setup(unsigned entries, io_uring_params* p)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argsz)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argsz));
+}
+
+static uint64_t makeUserData(int fd, uint32_t generation)
+{
+    return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+static bool probeIoUring()
+{
+    io_uring_params p;
+    bzero(&p, sizeof p);
+    int fd = io_uring_setup(2, &p);
+    if(fd < 0)
+    {
+        return false;   // 内核不支持io_uring或者被禁用了
+    }
+    // EXT_ARG: io_uring_enter支持超时(5.11)  RSRC_TAGS和multishot poll同在5.13引入
+    bool supported = (p.features & IORING_FEAT_EXT_ARG)
+                     && (p.features & IORING_FEAT_RSRC_TAGS)
+                     && (p.features & IORING_FEAT_NODROP);
+    ::close(fd);
+    return supported;
+}
+
+bool IoUringPoller::isSupported()
+{
+    // 只探测一次，结果对所有EventLoop都一样；多个线程同时创建EventLoop时，局部静态变量的初始化是线程安全的
+    static const bool supported = probeIoUring();
+    return supported;
+}
+
+IoUringPoller::IoUringPoller(EventLoop* loop)
+    : Poller(loop),
+      ringfd_(-1),
+      sqRingPtr_(MAP_FAILED),
+      sqRingSize_(0),
+      sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+      sqesSize_(0),
+      sqLocalTail_(0),
+      toSubmit_(0),
+      cqRingPtr_(MAP_FAILED),
+      cqRingSize_(0),
+      pollSeq_(0),
+      valid_(false)
+{
+    bzero(&params_, sizeof params_);
+    params_.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params_.cq_entries = kCqEntries;
+    ringfd_ = io_uring_setup(kSqEntries, &params_);
+    if(ringfd_ < 0)
+    {
+        LOG_INFO("io_uring_setup error : %d \n", errno);
+        return;
+    }
+    valid_ = setupRings();
+}
+
+// 构造失败时只释放已经创建的部分
+IoUringPoller::~IoUringPoller()
+{
+    if(sqes_ != MAP_FAILED)
+    {
+        ::munmap(sqes_, sqesSize_);
+    }
+    if(cqRingPtr_ != MAP_FAILED && cqRingPtr_ != sqRingPtr_)
+    {
+        ::munmap(cqRingPtr_, cqRingSize_);
+    }
+    if(sqRingPtr_ != MAP_FAILED)
+    {
+        ::munmap(sqRingPtr_, sqRingSize_);
+    }
+    if(ringfd_ >= 0)
+    {
+        ::close(ringfd_);
+    }
+}
+
+bool IoUringPoller::setupRings()
+{
+    sqRingSize_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    // SINGLE_MMAP: SQ和CQ可以用一次mmap映射
+    if(params_.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(cqRingSize_ > sqRingSize_)
+        {
+            sqRingSize_ = cqRingSize_;
+        }
+        cqRingSize_ = sqRingSize_;
+    }
+
+    sqRingPtr_ = ::mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ringfd_, IORING_OFF_SQ_RING);
+    if(sqRingPtr_ == MAP_FAILED)
+    {
+        LOG_INFO("io_uring mmap sq ring error : %d \n", errno);
+        return false;
+    }
+
+    if(params_.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cqRingPtr_ = sqRingPtr_;
+    }
+    else
+    {
+        cqRingPtr_ = ::mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ringfd_, IORING_OFF_CQ_RING);
+        if(cqRingPtr_ == MAP_FAILED)
+        {
+            LOG_INFO("io_uring mmap cq ring error : %d \n", errno);
+            return false;
+        }
+    }
+
+    sqesSize_ = params_.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES));
+    if(sqes_ == MAP_FAILED)
+    {
+        LOG_INFO("io_uring mmap sqes error : %d \n", errno);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqRingPtr_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+    sqLocalTail_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRingPtr_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+    return true;
+}
+
+Timestamp IoUringPoller::poll(int timeoutMs, ChannelList* activeChannels)
+{
+    LOG_DEBUG("func = %s, fd total count: %lu \n", __FUNCTION__, numChannels_);
+
+    ++pollSeq_;
+    // 上一轮上报过的一次性poll，channel还在关注事件就重新提交，fd仍然就绪时会立即完成(LT语义)
+    for(int fd : rearmFds_)
+    {
+        const ChannelSlot& slot = channels_[fd];
+        if(slot.channel != nullptr && slot.state == kAdded && !pollStateOf(fd).armed)
+        {
+            arm(slot.channel);
+        }
+    }
+    rearmFds_.clear();
+
+    int ret = submitAndWait(timeoutMs);
+    int saveErrno = errno;
+    Timestamp now(Timestamp::now());
+
+    int numEvents = fillActiveChannels(activeChannels);
+    if(numEvents > 0)
+    {
+        LOG_DEBUG("%d events happened \n", numEvents);
+    }
+    else if(ret >= 0 || saveErrno == ETIME)
+    {
+        LOG_DEBUG("%s timeout! \n", __FUNCTION__);
+    }
+    else if(saveErrno != EINTR)
+    {
+        errno = saveErrno;
+        LOG_DEBUG("IoUringPoller::poll() err!");
+    }
+    return now;
+}
+
+void IoUringPoller::updateChannel(Channel* channel)
+{
+    int fd = channel->fd();
+    ChannelSlot& slot = slotOf(fd);
+    LOG_INFO("func = %s, fd = %d, events = %d, state = %d \n"
+        , __FUNCTION__, fd, channel->events(), slot.state);
+
+    if(slot.state == kNew || slot.state == kDeleted)
+    {
+        if(slot.state == kNew)
+        {
+            slot.channel = channel;
+            ++numChannels_;
+        }
+        else if(channel->isNoneEvent())
+        {
+            return;
+        }
+        slot.state = kAdded;
+        slot.events = interestOf(channel);
+        arm(channel);
+    }
+    else if(channel->isNoneEvent())
+    {
+        disarm(fd);
+        slot.state = kDeleted;
+    }
+    else if(slot.events != interestOf(channel))   //关注的事件变了就先取消再重新提交
+    {
+        disarm(fd);
+        slot.events = interestOf(channel);
+        arm(channel);
+    }
+}
+
+void IoUringPoller::removeChannel(Channel* channel)
+{
+    int fd = channel->fd();
+    ChannelSlot& slot = slotOf(fd);
+
+    LOG_INFO("func = %s, fd = %d\n", __FUNCTION__, fd);
+
+    int state = slot.state;
+    if(slot.channel == channel)
+    {
+        slot.channel = nullptr;
+        --numChannels_;
+    }
+    slot.state = kNew;
+    if(state == kAdded)
+    {
+        disarm(fd);
+    }
+}
+
+IoUringPoller::PollState& IoUringPoller::pollStateOf(int fd)
+{
+    if(static_cast<size_t>(fd) >= states_.size())
+    {
+        states_.resize(channels_.size() > static_cast<size_t>(fd) ? channels_.size() : fd + 1);
+    }
+    return states_[fd];
+}
+
+void IoUringPoller::arm(Channel* channel)
+{
+    int fd = channel->fd();
+    PollState& state = pollStateOf(fd);
+    ++state.generation;
+    if(state.generation == 0)
+    {
+        state.generation = 1;
+    }
+    state.armed = true;
+
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = static_cast<uint32_t>(channel->events());
+    // ET的channel使用multishot，一次提交持续上报
+    sqe->len = channel->edgeTriggered() ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = makeUserData(fd, state.generation);
+}
+
+void IoUringPoller::disarm(int fd)
+{
+    if(static_cast<size_t>(fd) >= states_.size() || !states_[fd].armed)
+    {
+        return;
+    }
+    PollState& state = states_[fd];
+    state.armed = false;
+
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = makeUserData(fd, state.generation);
+    sqe->user_data = kIgnoreUserData;
+}
+
+io_uring_sqe* IoUringPoller::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if(sqLocalTail_ - head >= params_.sq_entries)
+    {
+        // SQ满了，先把已有的请求提交给内核，不等待
+        submitAndWait(-1);
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    }
+    unsigned index = sqLocalTail_ & *sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    bzero(sqe, sizeof *sqe);
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    ++toSubmit_;
+    return sqe;
+}
+
+// timeoutMs < 0 表示只提交不等待，和epoll_wait的-1含义不同，本类内部使用
+int IoUringPoller::submitAndWait(int timeoutMs)
+{
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    unsigned toSubmit = toSubmit_;
+    toSubmit_ = 0;
+
+    if(timeoutMs < 0)
+    {
+        return io_uring_enter(ringfd_, toSubmit, 0, 0, nullptr, 0);
+    }
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+
+    io_uring_getevents_arg arg;
+    bzero(&arg, sizeof arg);
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+    // CQ中已经有完成事件时内核不会阻塞
+    return io_uring_enter(ringfd_, toSubmit, 1,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg);
+}
+
+int IoUringPoller::fillActiveChannels(ChannelList* activeChannels)
+{
+    int numEvents = 0;
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for(; head != tail; ++head)
+    {
+        const io_uring_cqe& cqe = cqes_[head & *cqMask_];
+        if(cqe.user_data == kIgnoreUserData)
+        {
+            continue;
+        }
+
+        int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+        uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32);
+        Channel* channel = findChannel(fd);
+        // 已经取消或者被新的请求替换了，是过期的CQE
+        if(channel == nullptr || static_cast<size_t>(fd) >= states_.size()
+            || !states_[fd].armed || states_[fd].generation != generation)
+        {
+            continue;
+        }
+
+        PollState& state = states_[fd];
+        // 没有IORING_CQE_F_MORE表示这个poll请求已经结束了(一次性poll或者multishot被内核终止)
+        if(!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            state.armed = false;
+            rearmFds_.push_back(fd);
+        }
+        if(cqe.res < 0)
+        {
+            LOG_DEBUG("IoUringPoller poll fd = %d err : %d \n", fd, -cqe.res);
+            continue;
+        }
+
+        if(state.pollSeq == pollSeq_)
+        {
+            // multishot在一次poll()中上报了多次，合并事件
+            channel->set_revents(channel->revents() | cqe.res);
+        }
+        else
+        {
+            state.pollSeq = pollSeq_;
+            channel->set_revents(cqe.res);
+            activeChannels->push_back(channel);
+            ++numEvents;
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return numEvents;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Poller.h"
+#include "Timestamp.h"
+
+#include <vector>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+class Channel;
+
+/*
+    io_uring的使用，直接通过系统调用操作提交队列(SQ)和完成队列(CQ)，不依赖liburing
+    io_uring_setup      创建ring，mmap映射SQ、CQ和SQE数组
+    IORING_OP_POLL_ADD  关注fd上的事件，事件发生后产生一个CQE
+    IORING_OP_POLL_REMOVE 取消关注
+    io_uring_enter      一次系统调用同时提交所有积攒的SQE并等待CQE
+
+    和epoll一样只做就绪通知，Channel的读写仍然由read/write完成：
+    1. LT的Channel使用一次性poll，每次事件上报之后在下一次poll()时重新提交，
+       fd仍然就绪时内核会立即完成这个poll请求，语义和epoll的LT一致
+    2. ET的Channel使用multishot poll(IORING_POLL_ADD_MULTI)，提交一次之后持续上报，不需要重新提交
+    所有epoll_ctl式的修改都先放在SQ里，在poll()时和等待一起由一次io_uring_enter提交
+*/
+class IoUringPoller : public Poller
+{
+public:
+    IoUringPoller(EventLoop* loop);
+    ~IoUringPoller() override;
+
+    //重写基类Poller的抽象方法
+    Timestamp poll(int timeoutMs, ChannelList* activeChannels) override;
+    void updateChannel(Channel* channel) override;
+    void removeChannel(Channel* channel) override;
+
+    //当前内核是否支持本实现需要的io_uring特性(multishot poll、带超时的io_uring_enter)
+    static bool isSupported();
+
+    //ring是否创建成功。isSupported()通过之后io_uring_setup或mmap仍可能失败(比如RLIMIT_MEMLOCK用完)，
+    //这时不能使用，由newDefaultPoller删除后换成epoll
+    bool valid() const { return valid_; }
+
+private:
+    static const unsigned kSqEntries = 256;
+    static const unsigned kCqEntries = 4096;
+
+    //每个fd在ring中的状态，user_data由(generation << 32 | fd)组成，用来丢弃过期的CQE
+    struct PollState
+    {
+        PollState() : generation(0), armed(false), pollSeq(0) {}
+        uint32_t generation;    //每次提交POLL_ADD都加1
+        bool armed;             //内核中是否有这个fd的poll请求
+        uint64_t pollSeq;       //最近一次被放入activeChannels的poll序号，防止同一个channel重复上报
+    };
+
+    //映射SQ、CQ和SQE数组，失败返回false
+    bool setupRings();
+    //向内核注册/取消fd上的poll请求，只是放入SQ，等待下一次io_uring_enter提交
+    void arm(Channel* channel);
+    void disarm(int fd);
+    io_uring_sqe* getSqe();
+    PollState& pollStateOf(int fd);
+    //提交SQ中的请求，并最多等待timeoutMs毫秒直到至少有一个CQE
+    int submitAndWait(int timeoutMs);
+    //从CQ中取出完成事件，填写活跃的连接
+    int fillActiveChannels(ChannelList* activeChannels);
+
+    int ringfd_;
+    io_uring_params params_;
+
+    //SQ ring
+    void* sqRingPtr_;
+    size_t sqRingSize_;
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+    unsigned sqLocalTail_;      //本地的尾指针，submit时再写回sqTail_
+    unsigned toSubmit_;         //还没有提交的SQE个数
+
+    //CQ ring
+    void* cqRingPtr_;
+    size_t cqRingSize_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    io_uring_cqe* cqes_;
+
+    std::vector<PollState> states_;     //和channels_一样以fd为下标，channel删除后保留generation，防止fd复用时误认CQE
+    std::vector<int> rearmFds_;     //一次性poll已经上报，需要在下一次poll()时重新提交的fd
+    uint64_t pollSeq_;
+    bool valid_;
+};
@@ -0,0 +1,65 @@
+#include "MirroredRing.h"
+#include "BufferPool.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+std::unique_ptr<MirroredRing> MirroredRing::create(size_t capacity)
+{
+    size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    capacity = (capacity + pageSize - 1) / pageSize * pageSize;
+    if(capacity == 0)
+    {
+        capacity = pageSize;
+    }
+
+    int fd = ::memfd_create("dajunmuduo-ring", MFD_CLOEXEC);
+    if(fd < 0)
+    {
+        LOG_INFO("MirroredRing memfd_create failed, errno = %d\n", errno);
+        return std::unique_ptr<MirroredRing>();
+    }
+    if(::ftruncate(fd, capacity) < 0)
+    {
+        LOG_INFO("MirroredRing ftruncate failed, errno = %d\n", errno);
+        ::close(fd);
+        return std::unique_ptr<MirroredRing>();
+    }
+
+    // 先占住2 * capacity的地址空间，再把memfd固定映射到前后两半
+    void* reserved = ::mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(reserved == MAP_FAILED)
+    {
+        LOG_INFO("MirroredRing mmap reserve failed, errno = %d\n", errno);
+        ::close(fd);
+        return std::unique_ptr<MirroredRing>();
+    }
+    char* base = static_cast<char*>(reserved);
+    if(::mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || ::mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        LOG_INFO("MirroredRing mmap mirror failed, errno = %d\n", errno);
+        ::munmap(base, 2 * capacity);
+        ::close(fd);
+        return std::unique_ptr<MirroredRing>();
+    }
+    // 映射会保持memfd的引用，fd可以关闭了
+    ::close(fd);
+    return std::unique_ptr<MirroredRing>(new MirroredRing(base, capacity));
+}
+
+MirroredRing::MirroredRing(char* base, size_t capacity)
+    : base_(base),
+      capacity_(capacity),
+      pool_(BufferPool::current())
+{
+    pool_->addBytesInUse(capacity_);
+}
+
+MirroredRing::~MirroredRing()
+{
+    ::munmap(base_, 2 * capacity_);
+    pool_->addBytesInUse(-static_cast<int64_t>(capacity_));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <stddef.h>
+#include <memory>
+
+class BufferPool;
+
+/**
+ *  MirroredRing 把同一个memfd连续映射两次得到的环形内存
+ *  [base, base + capacity)和[base + capacity, base + 2 * capacity)是同一段物理内存，
+ *  从环上任意位置开始的capacity字节在虚拟地址上都是连续的，数据绕回时不需要拆成两段，也不需要搬动。
+ *  每个环占用两个内存映射，大量连接都使用时注意vm.max_map_count的限制。
+ */
+class MirroredRing : noncopyable
+{
+public:
+    // capacity向上取整到页大小，失败时返回空指针
+    static std::unique_ptr<MirroredRing> create(size_t capacity);
+    ~MirroredRing();
+
+    char* base() const { return base_; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    MirroredRing(char* base, size_t capacity);
+
+    char* base_;
+    size_t capacity_;
+    BufferPool* pool_;      // 计入创建线程的BufferPool的bytesInUse
+};
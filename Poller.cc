@@ -1,10 +1,16 @@
 #include "Poller.h"
 #include "Channel.h"
 
-Poller::Poller(EventLoop* loop) : ownerLoop_(loop) {}
+#include <sys/epoll.h>
+
+Poller::Poller(EventLoop* loop) : numChannels_(0), ownerLoop_(loop) {}
 
 bool Poller::hasChannel(Channel* channel) const
 {
-    auto it = channels_.find(channel->fd());
-    return it != channels_.end() && it->second == channel;
+    return findChannel(channel->fd()) == channel;
+}
+
+int Poller::interestOf(const Channel* channel)
+{
+    return channel->edgeTriggered() ? (channel->events() | EPOLLET) : channel->events();
 }
\ No newline at end of file
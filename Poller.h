@@ -1,6 +1,5 @@
 #pragma once
 #include "noncopyable.h"
-#include <unordered_map>
 #include "Timestamp.h"
 #include <vector>
 
@@ -35,10 +34,58 @@ public:
     //EventLoop可以通过该接口获取默认的IO复用的具体实现
     static Poller* newDefaultPoller(EventLoop* loop);
 protected:
-    //map的key : sockfd      val : sockfd所属的channel通道类型
-    using ChannelMap = std::unordered_map<int, Channel*>;
-    ChannelMap channels_; 
+    //channel在poller中的状态
+    enum ChannelState
+    {
+        kNew = -1,      //channel未添加到poller中
+        kAdded = 1,     //channel已添加到poller中
+        kDeleted = 2,   //channel从poller中删除(不再关注任何事件，但仍然保留在表中)
+    };
+
+    //fd表中的一项，保存fd所属的channel以及它在poller中的状态
+    struct ChannelSlot
+    {
+        ChannelSlot() : channel(nullptr), state(kNew), events(0) {}
+        Channel* channel;
+        int state;
+        int events;     //最近一次提交给内核的事件(包含EPOLLET)，相同的更新直接跳过
+    };
+
+    /**
+     *  fd是内核分配的最小可用整数，小而且稠密，直接用fd作为下标索引channel，
+     *  连接频繁建立、断开时不需要哈希，也不会分配和释放哈希表节点
+     */
+    using ChannelTable = std::vector<ChannelSlot>;
+
+    //返回fd对应的表项，表不够大时扩容
+    ChannelSlot& slotOf(int fd)
+    {
+        if(static_cast<size_t>(fd) >= channels_.size())
+        {
+            size_t size = channels_.empty() ? kInitChannelTableSize : channels_.size();
+            while(size <= static_cast<size_t>(fd))
+            {
+                size *= 2;
+            }
+            channels_.resize(size);
+        }
+        return channels_[fd];
+    }
+
+    //channel当前需要注册的事件，边缘触发时带上EPOLLET
+    static int interestOf(const Channel* channel);
+
+    //返回fd上注册的channel，没有则返回nullptr
+    Channel* findChannel(int fd) const
+    {
+        return static_cast<size_t>(fd) < channels_.size() ? channels_[fd].channel : nullptr;
+    }
+
+    ChannelTable channels_;
+    size_t numChannels_;    //表中注册了channel的fd个数
 private:
+    static const size_t kInitChannelTableSize = 64;
+
     EventLoop* ownerLoop_;  //定义Poller所属的事件循环EventLoop
 };
 
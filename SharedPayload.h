@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <stddef.h>
+
+/**
+ *  SharedPayload 引用计数的只读消息，拷贝只增加引用计数
+ *  同一条消息发给很多连接时(比如广播)，TcpConnection::send(const SharedPayload&)把它按引用排进输出队列，
+ *  发送时直接从这块内存writev，不拷贝到每个连接的outputBuffer_。
+ *  最后一个还没发完的连接发完之后内存才释放，构造之后不能再修改内容
+ */
+class SharedPayload
+{
+public:
+    SharedPayload() {}
+    explicit SharedPayload(std::string data)
+        : data_(std::make_shared<const std::string>(std::move(data)))
+    {
+    }
+    SharedPayload(const void* data, size_t len)
+        : data_(std::make_shared<const std::string>(static_cast<const char*>(data), len))
+    {
+    }
+
+    const char* data() const { return data_ ? data_->data() : nullptr; }
+    size_t size() const { return data_ ? data_->size() : 0; }
+    bool empty() const { return size() == 0; }
+
+    friend class TcpConnection;
+private:
+    std::shared_ptr<const std::string> data_;
+};
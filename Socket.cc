@@ -22,9 +22,9 @@ void Socket::bindAddress(const InetAddress& localaddr)
     }
 }
 
-void Socket::listen()
+void Socket::listen(int backlog)
 {
-    if(0 != ::listen(sockfd_, 1024))
+    if(0 != ::listen(sockfd_, backlog))
     {
         LOG_FATAL("listen sockfd:%d fail\n", sockfd_);
     }
@@ -75,4 +75,34 @@ void Socket::setKeepAlive(bool on)
 {
     int optval = on ? 1 : 0;
     ::setsockopt(sockfd_, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof optval);
+}
+
+void Socket::setBusyPoll(int usec)
+{
+#ifdef SO_BUSY_POLL
+    ::setsockopt(sockfd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof usec);
+#endif
+}
+
+bool Socket::setZeroCopy(bool on)
+{
+#ifdef SO_ZEROCOPY
+    int optval = on ? 1 : 0;
+    return ::setsockopt(sockfd_, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof optval) == 0;
+#else
+    (void)on;
+    return false;
+#endif
+}
+
+void Socket::setDeferAccept(int seconds)
+{
+    ::setsockopt(sockfd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof seconds);
+}
+
+void Socket::setIncomingCpu(int cpu)
+{
+#ifdef SO_INCOMING_CPU
+    ::setsockopt(sockfd_, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof cpu);
+#endif
 }
\ No newline at end of file
@@ -17,7 +17,7 @@ public:
 
     int fd() const { return sockfd_; }
     void bindAddress(const InetAddress& localaddr);
-    void listen();
+    void listen(int backlog = 1024);
     int accept(InetAddress* peeraddr);
 
     void shutdownWrite();
@@ -26,6 +26,14 @@ public:
     void setReuseAddr(bool on);
     void setReusePort(bool on);
     void setKeepAlive(bool on);
+    // TCP_DEFER_ACCEPT 连接上有数据到达(最多等seconds秒)才让accept返回，0表示关闭
+    void setDeferAccept(int seconds);
+    // SO_INCOMING_CPU 监听socket上设置后，SO_REUSEPORT组内优先把在该CPU上收到的连接交给这个socket
+    void setIncomingCpu(int cpu);
+    // SO_BUSY_POLL 让阻塞的读/poll在网卡队列上忙等usec微秒，内核不支持或没有权限时忽略
+    void setBusyPoll(int usec);
+    // SO_ZEROCOPY 允许在这个socket上使用MSG_ZEROCOPY发送，返回是否设置成功(内核4.14以上才支持)
+    bool setZeroCopy(bool on);
 
 private:
     const int sockfd_;
@@ -0,0 +1,59 @@
+#include "Strand.h"
+#include "ComputePool.h"
+
+Strand::Strand(const std::shared_ptr<ComputePool>& pool)
+    : pool_(pool),
+      running_(false)
+{
+}
+
+bool Strand::post(Functor&& task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(running_)
+    {
+        // 正在执行的run会继续执行这个任务；run在线程池停止期间重新提交也会被接收
+        tasks_.push_back(std::move(task));
+        return true;
+    }
+    // 在mutex_中提交run，其他线程不会在提交的结果出来之前把任务排到这个Strand上
+    std::shared_ptr<Strand> self = shared_from_this();
+    if(!pool_->submit([self]() { self->run(); }))
+    {
+        // 线程池已经停止，task没有被移走，调用者换个地方执行
+        return false;
+    }
+    tasks_.push_back(std::move(task));
+    running_ = true;
+    return true;
+}
+
+size_t Strand::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+}
+
+void Strand::run()
+{
+    for(int i = 0; i < kMaxBatch; ++i)
+    {
+        Functor task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(tasks_.empty())
+            {
+                running_ = false;
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+
+    // 还有任务没执行完，重新排队，让其他Strand的任务也有机会执行
+    // 这里在工作线程中，线程池停止期间也会接收
+    std::shared_ptr<Strand> self = shared_from_this();
+    pool_->submit([self]() { self->run(); });
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Task.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+class ComputePool;
+
+/**
+ *  Strand 在ComputePool上按提交顺序串行执行的一组任务
+ *  同一个Strand的任务任何时刻最多只有一个在执行，后一个任务一定在前一个执行完之后才开始，
+ *  但可以在不同的工作线程上执行。每个TcpConnection一个Strand，同一个连接的消息按顺序处理，
+ *  不同连接之间并行。
+ *  每次最多连续执行kMaxBatch个任务，然后重新提交到线程池，避免一个繁忙的连接长时间占用工作线程。
+ */
+class Strand : noncopyable, public std::enable_shared_from_this<Strand>
+{
+public:
+    using Functor = Task;
+
+    // 共享线程池的所有权，连接比TcpServer活得久时也不会用到已经释放的线程池
+    explicit Strand(const std::shared_ptr<ComputePool>& pool);
+
+    // 线程安全。线程池已经停止时返回false，task不会被移走
+    bool post(Functor&& task);
+
+    // 还没有执行的任务数
+    size_t pending() const;
+
+private:
+    static const int kMaxBatch = 16;
+
+    void run();
+
+    std::shared_ptr<ComputePool> pool_;
+    mutable std::mutex mutex_;
+    std::deque<Functor> tasks_;
+    bool running_;      // 是否已经有一个run提交到了线程池中，由mutex_保护
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/**
+ *  Task 只能移动的回调对象，EventLoop::runInLoop/queueInLoop使用的任务类型
+ *  std::function要求可拷贝，并且只有16字节的内联空间，像std::bind(&TcpConnection::connectDestroyed, conn)
+ *  这种带一个shared_ptr的任务每次都要在堆上分配。
+ *  Task内联了kInlineSize字节的空间，不超过这个大小的可调用对象直接构造在Task内部，不会分配内存；
+ *  超过的才放到堆上。只能移动，所以也可以捕获unique_ptr等只能移动的对象。
+ */
+class Task
+{
+public:
+    static const size_t kInlineSize = 64;
+
+    Task() noexcept : ops_(nullptr) {}
+    Task(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+    template<typename F,
+             typename = typename std::enable_if<
+                !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) : ops_(nullptr)
+    {
+        using Fn = typename std::decay<F>::type;
+        construct<Fn>(std::forward<F>(f), std::integral_constant<bool, fitsInline<Fn>()>());
+    }
+
+    Task(Task&& other) noexcept : ops_(other.ops_)
+    {
+        if(ops_)
+        {
+            ops_->move(storage(), other.storage());
+            other.ops_ = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            if(other.ops_)
+            {
+                ops_ = other.ops_;
+                ops_->move(storage(), other.storage());
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() { ops_->invoke(storage()); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+private:
+    // 每种可调用对象类型对应一组静态的操作函数，相当于手写的虚函数表
+    struct Ops
+    {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);     // 把src移动到dst，并析构src
+        void (*destroy)(void* self);
+    };
+
+    template<typename Fn>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Fn) <= kInlineSize
+            && alignof(Fn) <= alignof(max_align_t)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    // 内联存储：可调用对象就构造在storage_里
+    template<typename Fn>
+    struct InlineOps
+    {
+        static void invoke(void* self) { (*static_cast<Fn*>(self))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* self) { static_cast<Fn*>(self)->~Fn(); }
+        static const Ops ops;
+    };
+
+    // 堆存储：storage_里只保存指针，移动时只需要拷贝指针
+    template<typename Fn>
+    struct HeapOps
+    {
+        static Fn*& ptr(void* self) { return *static_cast<Fn**>(self); }
+        static void invoke(void* self) { (*ptr(self))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) Fn*(ptr(src));
+        }
+        static void destroy(void* self) { delete ptr(self); }
+        static const Ops ops;
+    };
+
+    template<typename Fn, typename F>
+    void construct(F&& f, std::true_type)
+    {
+        new (storage()) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+
+    template<typename Fn, typename F>
+    void construct(F&& f, std::false_type)
+    {
+        new (storage()) Fn*(new Fn(std::forward<F>(f)));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+
+    void reset()
+    {
+        if(ops_)
+        {
+            ops_->destroy(storage());
+            ops_ = nullptr;
+        }
+    }
+
+    void* storage() { return &storage_; }
+
+    typename std::aligned_storage<kInlineSize, alignof(max_align_t)>::type storage_;
+    const Ops* ops_;
+};
+
+template<typename Fn>
+const Task::Ops Task::InlineOps<Fn>::ops = {
+    &Task::InlineOps<Fn>::invoke, &Task::InlineOps<Fn>::move, &Task::InlineOps<Fn>::destroy };
+
+template<typename Fn>
+const Task::Ops Task::HeapOps<Fn>::ops = {
+    &Task::HeapOps<Fn>::invoke, &Task::HeapOps<Fn>::move, &Task::HeapOps<Fn>::destroy };
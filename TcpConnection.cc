@@ -3,6 +3,7 @@
 #include "Socket.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "Strand.h"
 
 #include <functional>
 #include <errno.h>
@@ -10,6 +11,14 @@
 #include <sys/socket.h>
 #include <strings.h>
 #include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <algorithm>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 
 static EventLoop* CheckLoopNotNull(EventLoop* loop)
 {
@@ -26,6 +35,10 @@ TcpConnection::TcpConnection(EventLoop* loop,
                             const InetAddress& localAddr,
                             const InetAddress& peerAddr)
         : loop_(CheckLoopNotNull(loop)),
+          routeLoop_(loop),
+          migrating_(false),
+          attached_(true),
+          bytesTransferred_(0),
           name_(nameArg),
           state_(kConnecting),
           reading_(true),
@@ -33,7 +46,23 @@ TcpConnection::TcpConnection(EventLoop* loop,
           channel_(new Channel(loop, sockfd)),
           localAddr_(localAddr),
           peerAddr_(peerAddr),
-          highWaterMark_(64*1024*1024)  // 64M
+          highWaterMark_(64*1024*1024),  // 64M
+          ioBudget_(kDefaultIoBudget),
+          autoCork_(false),
+          corked_(false),
+          segmentBytes_(0),
+          outputAppended_(0),
+          outputSent_(0),
+          zeroCopyThreshold_(0),
+          zeroCopyNextId_(0),
+          zeroCopyHits_(0),
+          zeroCopyCopied_(0),
+          idleTimeout_(0.0),
+          readTimeout_(0.0),
+          writeTimeout_(0.0),
+          idleEntry_(std::bind(&TcpConnection::handleTimeout, this, kIdleTimeout)),
+          readEntry_(std::bind(&TcpConnection::handleTimeout, this, kReadTimeout)),
+          writeEntry_(std::bind(&TcpConnection::handleTimeout, this, kWriteTimeout))
 {
     // 给channel设置相应的回调函数，当poller通知channel感兴趣的事件发生之后，channel会回调相应的操作函数
     channel_->setReadCallback(std::bind(&TcpConnection::handleRead, this, std::placeholders::_1));
@@ -43,11 +72,20 @@ TcpConnection::TcpConnection(EventLoop* loop,
 
     LOG_INFO("TcpConnection::ctor[%s] at fd = %d\n", name_.c_str(), sockfd);
     socket_->setKeepAlive(true);
+    // 创建时就计入loop的连接数，连接还没在loop上建立时，后面分配的连接也能看到它
+    getLoop()->addConnections(1);
 }
 
 TcpConnection::~TcpConnection()
 {
     LOG_INFO("TcpConnection::dtor[%s] at fd = %d state = %d\n", name_.c_str(), channel_->fd(), (int)state_);
+    for(const OutputSegment& segment : outputSegments_)
+    {
+        if(segment.fd >= 0)
+        {
+            ::close(segment.fd);
+        }
+    }
 }
 
 void TcpConnection::send(const std::string& buf)
@@ -55,49 +93,521 @@ void TcpConnection::send(const std::string& buf)
     // 处于连接状态才发送
     if(state_ == kConnected)
     {
-        if(loop_->isInLoopThread())
+        if(isInOwnerLoop())
         {
             // 如果是当前线程就直接发送
             sendInLoop(buf.c_str(), buf.size());
         }
         else
         {
-            //如果Loop在别的线程中这放到loop待执行回调队列执行
-            loop_->runInLoop(std::bind(&TcpConnection::sendInLoop, this, buf.c_str(), buf.size()));
+            //如果Loop在别的线程中(或者连接正在迁移)这放到loop待执行回调队列执行
+            //任务执行时buf可能已经析构了，需要拷贝一份
+            send(std::string(buf));
+        }
+    }
+}
+
+void TcpConnection::send(std::string&& buf)
+{
+    if(state_ == kConnected)
+    {
+        if(isInOwnerLoop())
+        {
+            sendStringInLoop(buf);
+        }
+        else
+        {
+            // 字符串移动进任务，Task只能移动，不需要再包一层shared_ptr
+            TcpConnectionPtr conn(shared_from_this());
+            queueInLoop([conn, message = std::move(buf)]() mutable { conn->sendStringInLoop(message); });
+        }
+    }
+}
+
+void TcpConnection::send(const void* data, size_t len)
+{
+    if(state_ == kConnected)
+    {
+        if(isInOwnerLoop())
+        {
+            sendInLoop(data, len);
+        }
+        else
+        {
+            send(std::string(static_cast<const char*>(data), len));
+        }
+    }
+}
+
+void TcpConnection::send(Buffer* buf)
+{
+    if(state_ == kConnected)
+    {
+        if(isInOwnerLoop())
+        {
+            sendBufferInLoop(buf);
+        }
+        else
+        {
+            // 块链表整个交换进任务，不拷贝数据
+            std::unique_ptr<Buffer> message(new Buffer);
+            message->swap(*buf);
+            TcpConnectionPtr conn(shared_from_this());
+            queueInLoop([conn, message = std::move(message)]() { conn->sendBufferInLoop(message.get()); });
+        }
+    }
+}
+
+void TcpConnection::send(const SharedPayload& payload)
+{
+    if(state_ == kConnected && !payload.empty())
+    {
+        if(isInOwnerLoop())
+        {
+            sendPayloadInLoop(payload);
+        }
+        else
+        {
+            TcpConnectionPtr conn(shared_from_this());
+            queueInLoop([conn, payload]() { conn->sendPayloadInLoop(payload); });
+        }
+    }
+}
+
+void TcpConnection::sendPayloadInLoop(const SharedPayload& payload)
+{
+    if(state_ == kDisconnected)
+    {
+        LOG_INFO("TcpConnection::sendPayloadInLoop disconnected, give up writing\n");
+        return;
+    }
+    bool zeroCopy = zeroCopyThreshold_ > 0 && payload.size() >= zeroCopyThreshold_;
+    queueSegmentInLoop(OutputSegment{-1, 0, payload.size(), outputAppended_, payload.data_, zeroCopy});
+}
+
+void TcpConnection::sendv(const struct iovec* iov, int iovcnt)
+{
+    if(state_ == kConnected)
+    {
+        if(isInOwnerLoop())
+        {
+            sendvInLoop(iov, iovcnt);
+        }
+        else
+        {
+            std::string message;
+            for(int i = 0; i < iovcnt; ++i)
+            {
+                message.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+            }
+            send(std::move(message));
         }
     }
 }
 
+void TcpConnection::sendStringInLoop(std::string& message)
+{
+    if(zeroCopyThreshold_ > 0 && message.size() >= zeroCopyThreshold_ && state_ != kDisconnected)
+    {
+        size_t len = message.size();
+        std::shared_ptr<const std::string> data = std::make_shared<const std::string>(std::move(message));
+        queueSegmentInLoop(OutputSegment{-1, 0, len, outputAppended_, std::move(data), true});
+        return;
+    }
+    sendInLoop(message.data(), message.size());
+}
+
+void TcpConnection::sendBufferInLoop(Buffer* buf)
+{
+    // 两个缓冲区的模式相同时才交换，否则会改变outputBuffer_的模式
+    if(state_ != kDisconnected && pendingOutputBytes() == 0 && !channel_->isWriting()
+        && buf->mirroredRing() == outputBuffer_.mirroredRing()
+        && (zeroCopyThreshold_ == 0 || buf->readableBytes() < zeroCopyThreshold_))
+    {
+        size_t len = buf->readableBytes();
+        outputBuffer_.swap(*buf);
+        outputAppended_ += len;
+        startOutput(0);
+        return;
+    }
+    sendInLoop(buf->peek(), buf->readableBytes());
+    buf->retrieveAll();
+}
+
+void TcpConnection::sendFile(int fd, off_t offset, size_t length)
+{
+    if(state_ != kConnected || length == 0)
+    {
+        return;
+    }
+    // 调用者返回后可能马上关闭自己的fd，排队期间用dup出来的fd
+    int fileFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(fileFd < 0)
+    {
+        LOG_INFO("TcpConnection::sendFile dup fd = %d failed, errno = %d\n", fd, errno);
+        return;
+    }
+    if(isInOwnerLoop())
+    {
+        sendFileInLoop(fileFd, offset, length);
+    }
+    else
+    {
+        TcpConnectionPtr conn(shared_from_this());
+        queueInLoop([conn, fileFd, offset, length]() { conn->sendFileInLoop(fileFd, offset, length); });
+    }
+}
+
+void TcpConnection::sendFileInLoop(int fd, off_t offset, size_t length)
+{
+    if(state_ == kDisconnected)
+    {
+        LOG_INFO("TcpConnection::sendFileInLoop disconnected, give up writing\n");
+        ::close(fd);
+        return;
+    }
+    queueSegmentInLoop(OutputSegment{fd, offset, length, outputAppended_, nullptr, false});
+}
+
+void TcpConnection::queueSegmentInLoop(OutputSegment segment)
+{
+    size_t oldlen = pendingOutputBytes();
+    segmentBytes_ += segment.remaining;
+    outputSegments_.push_back(std::move(segment));
+    startOutput(oldlen);
+}
+
+void TcpConnection::startOutput(size_t oldlen)
+{
+    // 前面没有排队的数据，直接发送；自动cork时留到本轮循环末尾
+    if(!channel_->isWriting() && oldlen == 0 && !autoCork_)
+    {
+        int saveErrno = 0;
+        ssize_t n = writeOutput(&saveErrno);
+        if(n > 0)
+        {
+            addBytesTransferred(n);
+            if(idleTimeout_ > 0)
+            {
+                getLoop()->timingWheel()->arm(&idleEntry_, idleTimeout_);
+            }
+        }
+        else if(n < 0 && saveErrno != EWOULDBLOCK)
+        {
+            LOG_INFO("TcpConnection::startOutput write failed, errno = %d\n", saveErrno);
+        }
+        if(pendingOutputBytes() == 0)
+        {
+            if(writeCompleteCallback_)
+            {
+                queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+            }
+            return;
+        }
+    }
+
+    size_t newlen = pendingOutputBytes();
+    if(newlen >= highWaterMark_ && oldlen < highWaterMark_ && highWaterMarkCallback_)
+    {
+        queueInLoop(std::bind(highWaterMarkCallback_, shared_from_this(), newlen));
+    }
+    waitForWritable();
+}
+
+void TcpConnection::waitForWritable()
+{
+    if(channel_->isWriting())
+    {
+        return;
+    }
+    if(autoCork_)
+    {
+        // 这一轮后面的send都追加到输出队列，本轮末尾一起写出
+        if(!corked_)
+        {
+            corked_ = true;
+            getLoop()->runAtIterationEnd(std::bind(&TcpConnection::flushCorkedOutput, shared_from_this()));
+        }
+        return;
+    }
+    if(writeTimeout_ > 0)
+    {
+        getLoop()->timingWheel()->arm(&writeEntry_, writeTimeout_);
+    }
+    //将通道置成可写状态。这样当通道活跃时，
+    //就会调用TcpConnection的可写方法。
+    //对实时要求高的数据，这种处理方法可能有一定的延时。
+
+    // 当可写事件被触发，就可以继续发送了，调用的是TcpConnection::handleWrite()
+    channel_->enableWriting();
+}
+
+/**
+ *  自动cork模式下在本轮循环末尾执行，把这一轮追加的数据一次写出去
+ *  ET模式下同样受ioBudget_限制，写不完的关注写事件，由handleWrite继续
+ */
+void TcpConnection::flushCorkedOutput()
+{
+    // 连接正在迁移，attachToLoop会在新loop上重新登记
+    if(!isInOwnerLoop())
+    {
+        return;
+    }
+    corked_ = false;
+    // 已经关注了写事件的由handleWrite继续发送
+    if(state_ == kDisconnected || channel_->isWriting())
+    {
+        return;
+    }
+
+    int saveErrno = 0;
+    ssize_t n = 0;
+    size_t total = 0;
+    while(pendingOutputBytes() > 0 && total < ioBudget_)
+    {
+        n = writeOutput(&saveErrno);
+        if(n <= 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    if(total > 0)
+    {
+        addBytesTransferred(total);
+        if(idleTimeout_ > 0)
+        {
+            getLoop()->timingWheel()->arm(&idleEntry_, idleTimeout_);
+        }
+    }
+
+    if(pendingOutputBytes() == 0)
+    {
+        outputDrained();
+        return;
+    }
+    if(n < 0 && saveErrno != EWOULDBLOCK)
+    {
+        LOG_INFO("TcpConnection::flushCorkedOutput write failed, errno = %d\n", saveErrno);
+    }
+    if(writeTimeout_ > 0)
+    {
+        getLoop()->timingWheel()->arm(&writeEntry_, writeTimeout_);
+    }
+    channel_->enableWriting();
+}
+
+void TcpConnection::outputDrained()
+{
+    if(channel_->isWriting())
+    {
+        // 不再关注写事件
+        channel_->disableWriting();
+    }
+    // 没有待发送的数据了，不再需要写超时
+    if(writeEntry_.armed())
+    {
+        getLoop()->timingWheel()->cancel(&writeEntry_);
+    }
+    if(writeCompleteCallback_)
+    {
+        // 唤醒loop_对应的thread线程，执行回调
+        queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+    }
+    if(writeWaiter_)
+    {
+        Waiter waiter;
+        waiter.swap(writeWaiter_);
+        if(!waiter())
+        {
+            writeWaiter_.swap(waiter);
+        }
+    }
+    // 如果当前状态是正在关闭连接，那么就调用shutdown来主动关闭连接
+    if(state_ == kDisconnecting)
+    {
+        shutdownInLoop();
+    }
+}
+
+ssize_t TcpConnection::writeOutput(int* saveErrno)
+{
+    while(!outputSegments_.empty() && outputSegments_.front().position == outputSent_)
+    {
+        // 输出段前面的缓冲数据都发完了，发送输出段
+        ssize_t n = writeSegment(saveErrno);
+        if(n < 0)
+        {
+            return n;
+        }
+        if(n > 0)
+        {
+            // 连续的内存块合并写的时候可能跨过好几个段
+            segmentBytes_ -= n;
+            size_t left = n;
+            while(left > 0)
+            {
+                OutputSegment& segment = outputSegments_.front();
+                size_t m = std::min(left, segment.remaining);
+                segment.remaining -= m;
+                if(segment.fd < 0)
+                {
+                    segment.offset += m;
+                }
+                left -= m;
+                if(segment.remaining == 0)
+                {
+                    if(segment.fd >= 0)
+                    {
+                        ::close(segment.fd);
+                    }
+                    outputSegments_.pop_front();
+                }
+            }
+            return n;
+        }
+        // 文件比length短，剩下的部分发不出去了，跳过这一段
+        OutputSegment& segment = outputSegments_.front();
+        LOG_INFO("TcpConnection::writeOutput file fd = %d ended %zu bytes early\n", segment.fd, segment.remaining);
+        segmentBytes_ -= segment.remaining;
+        ::close(segment.fd);
+        outputSegments_.pop_front();
+    }
+
+    if(outputBuffer_.readableBytes() == 0)
+    {
+        return 0;
+    }
+    // 有输出段在排队时，只发送排在它前面的缓冲数据
+    size_t maxBytes = outputSegments_.empty()
+                        ? outputBuffer_.readableBytes()
+                        : static_cast<size_t>(outputSegments_.front().position - outputSent_);
+    ssize_t n = outputBuffer_.writeFd(channel_->fd(), saveErrno, maxBytes);
+    if(n > 0)
+    {
+        // 调整发送buffer的内部index，以便下次继续发送
+        outputBuffer_.retrieve(n);
+        outputSent_ += n;
+    }
+    return n;
+}
+
+ssize_t TcpConnection::writeSegment(int* saveErrno)
+{
+    OutputSegment& segment = outputSegments_.front();
+    ssize_t n = 0;
+    if(segment.fd >= 0)
+    {
+        n = ::sendfile(channel_->fd(), segment.fd, &segment.offset, segment.remaining);
+    }
+    else if(segment.zeroCopy)
+    {
+        const char* data = segment.data->data() + segment.offset;
+        n = ::send(channel_->fd(), data, segment.remaining, MSG_ZEROCOPY);
+        if(n > 0)
+        {
+            // 内核引用着这块内存，收到完成通知之前不能释放
+            zeroCopyInflight_.push_back(ZeroCopyChunk{zeroCopyNextId_++, segment.data});
+        }
+        else if(n < 0 && errno == ENOBUFS)
+        {
+            // 锁定的页面超过了optmem限制，这一次改用普通发送
+            zeroCopyCopied_.fetch_add(1, std::memory_order_relaxed);
+            n = ::write(channel_->fd(), data, segment.remaining);
+        }
+    }
+    else
+    {
+        // 紧挨着的内存块之间没有缓冲数据(position相同)，一次writev发出去
+        struct iovec vec[kMaxWriteSegments];
+        int iovcnt = 0;
+        for(auto it = outputSegments_.begin();
+            it != outputSegments_.end() && iovcnt < kMaxWriteSegments
+                && it->fd < 0 && !it->zeroCopy && it->position == outputSent_;
+            ++it)
+        {
+            vec[iovcnt].iov_base = const_cast<char*>(it->data->data() + it->offset);
+            vec[iovcnt].iov_len = it->remaining;
+            ++iovcnt;
+        }
+        n = ::writev(channel_->fd(), vec, iovcnt);
+    }
+    if(n < 0)
+    {
+        *saveErrno = errno;
+    }
+    return n;
+}
+
+void TcpConnection::appendOutput(const char* data, size_t len)
+{
+    outputBuffer_.append(data, len);
+    outputAppended_ += len;
+}
+
 /**
  *  发送数据    应用写的快，而内核发送数据慢，需要把待发送数据写入缓冲区，并且设置了水位回调
  */
 void TcpConnection::sendInLoop(const void* message, size_t len)
 {
+    struct iovec vec;
+    vec.iov_base = const_cast<void*>(message);
+    vec.iov_len = len;
+    sendvInLoop(&vec, 1);
+}
+
+void TcpConnection::sendvInLoop(const struct iovec* iov, int iovcnt)
+{
+    size_t len = 0;
+    for(int i = 0; i < iovcnt; ++i)
+    {
+        len += iov[i].iov_len;
+    }
     ssize_t nwrote = 0;
     size_t remaining = len;
     bool faultError = false;
 
-    // 之前调用过该connection的shutdown，不能再进行发送了
+    // 连接已经断开，不能再进行发送了。跨线程的send可能在连接关闭之后才执行，不能让整个进程退出
     if(state_ == kDisconnected)
     {
-        LOG_ERROR("disconnected, give up writing!");
+        LOG_INFO("TcpConnection::sendvInLoop disconnected, give up writing\n");
+        return;
+    }
+
+    // 大消息拷贝一次到单独的内存块，用MSG_ZEROCOPY发送，之后的数据排在它后面
+    if(zeroCopyThreshold_ > 0 && len >= zeroCopyThreshold_)
+    {
+        std::string data;
+        data.reserve(len);
+        for(int i = 0; i < iovcnt; ++i)
+        {
+            data.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+        sendStringInLoop(data);
         return;
     }
 
     //如果通道没在写数据，同时输出缓存是空的
-    //则直接往fd中写数据，即发送
-    if(!channel_->isWriting() && outputBuffer_.readableBytes() == 0)
+    //则直接往fd中写数据，即发送；自动cork时留到本轮循环末尾
+    if(!channel_->isWriting() && pendingOutputBytes() == 0 && !autoCork_)
     {
-        nwrote = ::write(channel_->fd(), message, len);
+        // 片段超过IOV_MAX时先写前IOV_MAX个，剩下的追加到outputBuffer
+        nwrote = iovcnt == 1 ? ::write(channel_->fd(), iov[0].iov_base, len)
+                             : ::writev(channel_->fd(), iov, std::min(iovcnt, IOV_MAX));
         if(nwrote >= 0)
         {
+            addBytesTransferred(nwrote);
+            if(idleTimeout_ > 0)
+            {
+                getLoop()->timingWheel()->arm(&idleEntry_, idleTimeout_);
+            }
             //发送数据 >= 0
             remaining = len - nwrote;
             if(remaining == 0 && writeCompleteCallback_)
             {
                 //若数据一次性都发完了，同时也设置了写完成回调。
 	            //则调用下写完成回调函数。
-                loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
+                queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
             }
         }
         else    // nwrote < 0
@@ -107,7 +617,8 @@ void TcpConnection::sendInLoop(const void* message, size_t len)
             nwrote = 0;
             if(errno != EWOULDBLOCK)
             {
-                LOG_ERROR("TcpConnection::sendInLoop err");
+                // 对端已经关闭或者重置，连接随后由handleClose/handleError关闭
+                LOG_INFO("TcpConnection::sendvInLoop err:%d\n", errno);
                 if(errno == EPIPE || errno == ECONNRESET)   //  SIGPIPE RESET
                 {
                     faultError = true;
@@ -116,28 +627,30 @@ void TcpConnection::sendInLoop(const void* message, size_t len)
         }
     }
 
-    // 如果还有残留的数据没有发送完成
-    if(remaining > 0)
+    // 如果还有残留的数据没有发送完成；对端已经关闭或重置时不再缓存，也不再关注可写事件
+    if(!faultError && remaining > 0)
     {
-        size_t oldlen = outputBuffer_.readableBytes();
+        size_t oldlen = pendingOutputBytes();
         if(oldlen + remaining >= highWaterMark_ && oldlen < highWaterMark_ && highWaterMarkCallback_)
         {
             //添加新的待发送数据之后，如果数据大小已超过设置的警戒线
 	        //则回调下设置的高水平阀值回调函数，对现有的长度做出处理。
 	        //高水平水位线的使用场景?
-            loop_->queueInLoop(std::bind(highWaterMarkCallback_, shared_from_this(), oldlen + remaining));
+            queueInLoop(std::bind(highWaterMarkCallback_, shared_from_this(), oldlen + remaining));
         }
-        // 往outputBuffer后面添加数据
-        outputBuffer_.append(static_cast<const char*>(message) + nwrote, remaining);
-        if(!channel_->isWriting())
+        // 往outputBuffer后面添加数据，跳过已经写出去的片段，不需要先拼接
+        size_t skip = nwrote;
+        for(int i = 0; i < iovcnt; ++i)
         {
-            //将通道置成可写状态。这样当通道活跃时，
-	        //就会调用TcpConnection的可写方法。
-	        //对实时要求高的数据，这种处理方法可能有一定的延时。
-
-            // 当可写事件被触发，就可以继续发送了，调用的是TcpConnection::handleWrite()
-            channel_->enableWriting();
+            if(skip >= iov[i].iov_len)
+            {
+                skip -= iov[i].iov_len;
+                continue;
+            }
+            appendOutput(static_cast<const char*>(iov[i].iov_base) + skip, iov[i].iov_len - skip);
+            skip = 0;
         }
+        waitForWritable();
     }
 
 }
@@ -148,7 +661,7 @@ void TcpConnection::shutdown()
     if(state_ == kConnected)
     {
         setState(kDisconnecting);
-        loop_->runInLoop(std::bind(&TcpConnection::shutdownInLoop, this));
+        runInLoop(std::bind(&TcpConnection::shutdownInLoop, this));
     }
 }
 
@@ -159,7 +672,8 @@ void TcpConnection::shutdown()
  */
 void TcpConnection::shutdownInLoop()
 {
-    if(!channel_->isWriting()){     // 说明outputBuffer中的数据已经全部发送完成
+    // 自动cork时数据可能还留在输出队列里等本轮末尾发送，flushCorkedOutput发完之后再关闭
+    if(!channel_->isWriting() && !corked_){     // 说明outputBuffer中的数据已经全部发送完成
         socket_->shutdownWrite();   // 关闭写端
     }
 }
@@ -173,8 +687,18 @@ void TcpConnection::shutdownInLoop()
 void TcpConnection::connectEstablished()
 {
     setState(kConnected);
+    if(getLoop()->sockBusyPollMicros() > 0)
+    {
+        socket_->setBusyPoll(getLoop()->sockBusyPollMicros());
+    }
+    if(zeroCopyThreshold_ > 0 && !socket_->setZeroCopy(true))
+    {
+        LOG_INFO("TcpConnection::connectEstablished [%s] SO_ZEROCOPY not supported, errno = %d\n", name_.c_str(), errno);
+        zeroCopyThreshold_ = 0;
+    }
     channel_->tie(shared_from_this());
     channel_->enableReading();  // 向poller注册channel的epollin事件, 最终调用epoll_ctl
+    armTimeouts();
 
     // 连接成功，回调客户注册的函数（由用户提供的函数，比如OnConnection）
     connectionCallback_(shared_from_this());
@@ -193,31 +717,95 @@ void TcpConnection::connectDestroyed()
     {
         setState(kDisconnected);
         channel_->disableAll();
+        wakeWaiters();
         connectionCallback_(shared_from_this());
     }
+    cancelTimeouts();
     channel_->remove();
+    getLoop()->addConnections(-1);
+}
+
+void TcpConnection::wakeWaiters()
+{
+    Waiter readWaiter;
+    Waiter writeWaiter;
+    readWaiter.swap(readWaiter_);
+    writeWaiter.swap(writeWaiter_);
+    if(readWaiter)
+    {
+        readWaiter();
+    }
+    if(writeWaiter)
+    {
+        writeWaiter();
+    }
 }
 
 /**
  *  当某个channel有读事件发生时，会调用TcpConnection::handleRead()函数，
  *  然后从socket里读入数据到buffer，再通过回调把这些数据返回给用户层。
+ *  ET模式下需要一直读到EAGAIN，否则剩下的数据不会再触发可读事件；
+ *  每次最多读ioBudget_字节，超出预算时把剩下的工作放到本轮循环的末尾，避免一个连接饿死其他连接
  */
 void TcpConnection::handleRead(Timestamp receiveTime)
 {
     int saveErrno = 0;
-    // 读数据到inputBuffer_中
-    ssize_t n = inputBuffer_.readFd(channel_->fd(), &saveErrno);
-    if(n > 0)
+    ssize_t n = 0;
+    size_t total = 0;
+    bool edgeTriggered = channel_->edgeTriggered();
+    do
     {
-        // 已建立连接的用户，有可读事件发生了，调用用户传入的回调操作onMessage
-        messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+        // 读数据到inputBuffer_中
+        n = inputBuffer_.readFd(channel_->fd(), &saveErrno);
+        if(n > 0)
+        {
+            total += n;
+        }
+    } while(edgeTriggered && n > 0 && total < ioBudget_);
+
+    if(total > 0)
+    {
+        addBytesTransferred(total);
+        // 收到数据，延后读超时和空闲超时
+        if(readTimeout_ > 0)
+        {
+            getLoop()->timingWheel()->arm(&readEntry_, readTimeout_);
+        }
+        if(idleTimeout_ > 0)
+        {
+            getLoop()->timingWheel()->arm(&idleEntry_, idleTimeout_);
+        }
+        if(readWaiter_)
+        {
+            // 协程在等待数据，先取下等待者，恢复的协程可能马上设置新的等待者
+            Waiter waiter;
+            waiter.swap(readWaiter_);
+            if(!waiter())
+            {
+                readWaiter_.swap(waiter);
+            }
+        }
+        else if(messageCallback_)
+        {
+            // 已建立连接的用户，有可读事件发生了，调用用户传入的回调操作onMessage
+            messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+        }
     }
+
     // 读到了0，表明客户端已经关闭了
-    else if(n == 0)
+    if(n == 0)
     {
         handleClose();
     }
-    else
+    else if(n > 0)
+    {
+        if(edgeTriggered)
+        {
+            // ET模式下用完了本次的读预算，socket里可能还有数据
+            getLoop()->queueInLoop(std::bind(&TcpConnection::continueReading, shared_from_this(), receiveTime));
+        }
+    }
+    else if(!(edgeTriggered && (saveErrno == EAGAIN || saveErrno == EWOULDBLOCK)))
     {
         errno = saveErrno;
         LOG_ERROR("TcpConnection::handleRead err");
@@ -227,36 +815,51 @@ void TcpConnection::handleRead(Timestamp receiveTime)
 
 /**
  *  当可写事件发生时调用TcpConnection::handleWrite()
+ *  ET模式下一直写到EAGAIN或者outputBuffer_为空，同样受ioBudget_限制
  */
 void TcpConnection::handleWrite()
 {
     if(channel_->isWriting())
     {
         int saveErrno = 0;
-        // 写数据
-        ssize_t n = outputBuffer_.writeFd(channel_->fd(), &saveErrno);
-        if(n > 0)
+        ssize_t n = 0;
+        size_t total = 0;
+        bool edgeTriggered = channel_->edgeTriggered();
+        do
         {
-            // 调整发送buffer的内部index，以便下次继续发送
-            outputBuffer_.retrieve(n);
+            // 写数据，缓冲数据和sendFile的文件段按顺序发送
+            n = writeOutput(&saveErrno);
+            if(n > 0)
+            {
+                total += n;
+            }
+        } while(edgeTriggered && n > 0 && pendingOutputBytes() > 0 && total < ioBudget_);
+
+        // 输出队列最后一个文件段提前结束时，可能没有写出任何数据就发完了
+        if(total > 0 || pendingOutputBytes() == 0)
+        {
+            addBytesTransferred(total);
+            // 发送有进展，延后写超时和空闲超时
+            if(idleTimeout_ > 0)
+            {
+                getLoop()->timingWheel()->arm(&idleEntry_, idleTimeout_);
+            }
+            if(writeTimeout_ > 0)
+            {
+                getLoop()->timingWheel()->arm(&writeEntry_, writeTimeout_);
+            }
             // 如果对于系统发送函数来说，可读的数据量为0，表示所有数据都被发送完毕了，即写完成了
-            if(outputBuffer_.readableBytes() == 0)
+            if(pendingOutputBytes() == 0)
             {
-                // 不再关注写事件
-                channel_->disableWriting();
-                if(writeCompleteCallback_)
-                {
-                    // 唤醒loop_对应的thread线程，执行回调
-                    loop_->queueInLoop(std::bind(writeCompleteCallback_, shared_from_this()));
-                }
-                // 如果当前状态是正在关闭连接，那么就调用shutdown来主动关闭连接
-                if(state_ == kDisconnecting)
-                {
-                    shutdownInLoop();
-                }
+                outputDrained();
+            }
+            else if(edgeTriggered && n > 0)
+            {
+                // ET模式下用完了本次的写预算，socket仍然可写，不会再有新的EPOLLOUT通知
+                getLoop()->queueInLoop(std::bind(&TcpConnection::continueWriting, shared_from_this()));
             }
         }
-        else
+        else if(!(edgeTriggered && (saveErrno == EAGAIN || saveErrno == EWOULDBLOCK)))
         {
             LOG_ERROR("TcpConnection::handleWrite err");
         }
@@ -267,6 +870,32 @@ void TcpConnection::handleWrite()
     }
 }
 
+// ET模式下超出读写预算后，在本轮循环末尾继续读写，此时连接可能已经被关闭了
+// 连接也可能已经开始迁移，这时放弃，channel注册到新loop时poller会重新报告socket上的就绪状态
+void TcpConnection::continueReading(Timestamp receiveTime)
+{
+    if(!isInOwnerLoop())
+    {
+        return;
+    }
+    if((state_ == kConnected || state_ == kDisconnecting) && channel_->isReading())
+    {
+        handleRead(receiveTime);
+    }
+}
+
+void TcpConnection::continueWriting()
+{
+    if(!isInOwnerLoop())
+    {
+        return;
+    }
+    if(state_ != kDisconnected && channel_->isWriting())
+    {
+        handleWrite();
+    }
+}
+
 /**
  *  当对端调用shutdown()关闭连接时，本端会收到一个FIN，channel的读事件被触发，但inputBuffer_.readFd() 会返回0，然后调用
  *  handleClose()，处理关闭事件，最后调用TcpServer::removeConnection()。
@@ -278,8 +907,10 @@ void TcpConnection::handleClose()
     setState(kDisconnected);
     // channel上不再关注任何事情
     channel_->disableAll();
+    cancelTimeouts();
     // 获得shared_ptr交由tcpsever处理
     TcpConnectionPtr connPtr(shared_from_this());
+    wakeWaiters();
     connectionCallback_(connPtr);   // 执行关闭连接的回调
     closeCallback_(connPtr);        // 关闭连接的回调   执行的是TcpServer::removeConnection回调方法
 }
@@ -287,6 +918,11 @@ void TcpConnection::handleClose()
 // 处理出错事件
 void TcpConnection::handleError()
 {
+    // 零拷贝的完成通知也通过EPOLLERR上报，不是真正的错误
+    if(zeroCopyThreshold_ > 0 && handleZeroCopyCompletions())
+    {
+        return;
+    }
     int optval;
     socklen_t optlen = sizeof optval;
     int err = 0;
@@ -301,3 +937,297 @@ void TcpConnection::handleError()
     }
     LOG_ERROR("TcpConnection::handleError name:%s - SO_ERROR:%d\n", name_.c_str(), err);
 }
+
+bool TcpConnection::handleZeroCopyCompletions()
+{
+    bool handled = false;
+    while(true)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg;
+        ::bzero(&msg, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        if(::recvmsg(channel_->fd(), &msg, MSG_ERRQUEUE) < 0)
+        {
+            // EAGAIN，错误队列读完了
+            break;
+        }
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            const struct sock_extended_err* serr = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+            handled = true;
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zeroCopyCopied_.fetch_add(hi - lo + 1, std::memory_order_relaxed);
+            }
+            else
+            {
+                zeroCopyHits_.fetch_add(hi - lo + 1, std::memory_order_relaxed);
+            }
+            // 编号是32位的，会回绕，用差值比较
+            while(!zeroCopyInflight_.empty()
+                && static_cast<int32_t>(hi - zeroCopyInflight_.front().id) >= 0)
+            {
+                zeroCopyInflight_.pop_front();
+            }
+        }
+    }
+    return handled;
+}
+
+void TcpConnection::setEdgeTriggered(bool on)
+{
+    channel_->setEdgeTriggered(on);
+}
+
+void TcpConnection::setIdleTimeout(double seconds)
+{
+    runInLoop(std::bind(&TcpConnection::setTimeoutInLoop, shared_from_this(), kIdleTimeout, seconds));
+}
+
+void TcpConnection::setReadTimeout(double seconds)
+{
+    runInLoop(std::bind(&TcpConnection::setTimeoutInLoop, shared_from_this(), kReadTimeout, seconds));
+}
+
+void TcpConnection::setWriteTimeout(double seconds)
+{
+    runInLoop(std::bind(&TcpConnection::setTimeoutInLoop, shared_from_this(), kWriteTimeout, seconds));
+}
+
+void TcpConnection::setTimeoutInLoop(TimeoutKind kind, double seconds)
+{
+    switch(kind)
+    {
+        case kIdleTimeout:
+            idleTimeout_ = seconds;
+            break;
+        case kReadTimeout:
+            readTimeout_ = seconds;
+            break;
+        case kWriteTimeout:
+            writeTimeout_ = seconds;
+            break;
+    }
+    // 连接还没建立，等connectEstablished时再挂载
+    if(state_ == kConnected || state_ == kDisconnecting)
+    {
+        armTimeouts();
+    }
+}
+
+void TcpConnection::armTimeouts()
+{
+    if(idleTimeout_ <= 0 && readTimeout_ <= 0 && writeTimeout_ <= 0)
+    {
+        // 没有设置任何超时，不必创建时间轮
+        cancelTimeouts();
+        return;
+    }
+
+    TimingWheel* wheel = getLoop()->timingWheel();
+    if(idleTimeout_ > 0)
+    {
+        wheel->arm(&idleEntry_, idleTimeout_);
+    }
+    else
+    {
+        wheel->cancel(&idleEntry_);
+    }
+
+    if(readTimeout_ > 0)
+    {
+        wheel->arm(&readEntry_, readTimeout_);
+    }
+    else
+    {
+        wheel->cancel(&readEntry_);
+    }
+
+    // 写超时只在有待发送数据时生效
+    if(writeTimeout_ > 0 && channel_->isWriting())
+    {
+        wheel->arm(&writeEntry_, writeTimeout_);
+    }
+    else
+    {
+        wheel->cancel(&writeEntry_);
+    }
+}
+
+void TcpConnection::cancelTimeouts()
+{
+    if(idleEntry_.armed() || readEntry_.armed() || writeEntry_.armed())
+    {
+        TimingWheel* wheel = getLoop()->timingWheel();
+        wheel->cancel(&idleEntry_);
+        wheel->cancel(&readEntry_);
+        wheel->cancel(&writeEntry_);
+    }
+}
+
+// 时间轮上的超时节点到期，走和对端关闭连接相同的handleClose流程
+void TcpConnection::handleTimeout(TimeoutKind kind)
+{
+    if(state_ == kConnected || state_ == kDisconnecting)
+    {
+        LOG_INFO("TcpConnection::handleTimeout [%s] fd = %d, kind = %d\n", name_.c_str(), channel_->fd(), (int)kind);
+        handleClose();
+    }
+}
+
+bool TcpConnection::isInOwnerLoop() const
+{
+    EventLoop* loop = getLoop();
+    return loop->isInLoopThread() && attached_ && routeLoop_.load(std::memory_order_relaxed) == loop;
+}
+
+void TcpConnection::runInLoop(Functor cb)
+{
+    if(isInOwnerLoop())
+    {
+        cb();
+    }
+    else
+    {
+        queueInLoop(std::move(cb));
+    }
+}
+
+void TcpConnection::runInWorker(Functor task)
+{
+    // 计算线程池已经停止(TcpServer正在析构)时，同样交给runInLoop
+    if(strand_ && strand_->post(std::move(task)))
+    {
+        return;
+    }
+    runInLoop(std::move(task));
+}
+
+void TcpConnection::queueInLoop(Functor cb)
+{
+    std::lock_guard<std::mutex> lock(routeMutex_);
+    EventLoop* loop = routeLoop_.load(std::memory_order_relaxed);
+    if(!migrating_)
+    {
+        // 连接就挂在loop上，即使之后开始迁移，这个任务也排在detachFromLoop之前
+        loop->queueInLoop(std::move(cb));
+    }
+    else
+    {
+        TcpConnectionPtr conn(shared_from_this());
+        loop->queueInLoop([conn, cb = std::move(cb)]() mutable { conn->runTask(cb); });
+    }
+}
+
+void TcpConnection::runTask(Functor& cb)
+{
+    if(getLoop()->isInLoopThread() && attached_)
+    {
+        cb();
+    }
+    else if(routeLoop_.load()->isInLoopThread())
+    {
+        // 连接正在迁移到这个loop上，等attachToLoop时按到达的顺序执行
+        parkedTasks_.push_back(std::move(cb));
+    }
+    else
+    {
+        // 任务所在的loop已经不是连接所在的loop了，转发过去
+        queueInLoop(std::move(cb));
+    }
+}
+
+void TcpConnection::moveToLoop(EventLoop* loop)
+{
+    runInLoop(std::bind(&TcpConnection::moveToLoopInLoop, shared_from_this(), loop));
+}
+
+/**
+ *  迁移第一步，在旧loop线程中执行
+ *  切换routeLoop_之后，新投递的任务都发往新loop；切换之前投递到旧loop的任务都已经在旧loop的队列里了(routeMutex_保证)，
+ *  detachFromLoop排在它们后面，所以它们都会在旧loop上执行完，数据不会乱序
+ */
+void TcpConnection::moveToLoopInLoop(EventLoop* loop)
+{
+    if(loop == getLoop() || state_ != kConnected)
+    {
+        return;
+    }
+    bool alreadyMigrating = true;
+    {
+        std::lock_guard<std::mutex> lock(routeMutex_);
+        if(!migrating_)
+        {
+            routeLoop_.store(loop, std::memory_order_relaxed);
+            migrating_ = true;
+            alreadyMigrating = false;
+        }
+    }
+    if(alreadyMigrating)
+    {
+        // 上一次迁移还没完成(attachToLoop执行暂存的任务时又调用了moveToLoop)，排到这次迁移之后
+        queueInLoop(std::bind(&TcpConnection::moveToLoopInLoop, shared_from_this(), loop));
+        return;
+    }
+    LOG_INFO("TcpConnection::moveToLoop [%s] fd = %d from %p to %p\n", name_.c_str(), channel_->fd(), getLoop(), loop);
+    getLoop()->queueInLoop(std::bind(&TcpConnection::detachFromLoop, shared_from_this(), loop));
+}
+
+// 迁移第二步，在旧loop线程中执行：从旧loop上摘除，关注的事件、缓冲区都保留
+void TcpConnection::detachFromLoop(EventLoop* loop)
+{
+    cancelTimeouts();
+    channel_->remove();
+    getLoop()->addConnections(-1);
+    attached_ = false;
+    loop_.store(loop, std::memory_order_release);
+    loop->queueInLoop(std::bind(&TcpConnection::attachToLoop, shared_from_this()));
+}
+
+// 迁移第三步，在新loop线程中执行：重新注册channel，恢复超时，执行迁移途中到达的任务
+void TcpConnection::attachToLoop()
+{
+    EventLoop* loop = getLoop();
+    attached_ = true;
+    loop->addConnections(1);
+    if(loop->sockBusyPollMicros() > 0)
+    {
+        socket_->setBusyPoll(loop->sockBusyPollMicros());
+    }
+    channel_->setLoop(loop);
+    if(state_ == kConnected || state_ == kDisconnecting)
+    {
+        armTimeouts();
+    }
+    {
+        // 暂存的任务里可能再次调用moveToLoop，要先结束这一次迁移
+        std::lock_guard<std::mutex> lock(routeMutex_);
+        migrating_ = false;
+    }
+    if(corked_)
+    {
+        // 旧loop上登记的flushCorkedOutput没有执行，在新loop上重新登记
+        corked_ = false;
+        waitForWritable();
+    }
+
+    std::vector<Functor> tasks;
+    tasks.swap(parkedTasks_);
+    for(Functor& task : tasks)
+    {
+        task();
+    }
+}
\ No newline at end of file
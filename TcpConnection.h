@@ -4,14 +4,27 @@
 #include "Callbacks.h"
 #include "Buffer.h"
 #include "Timestamp.h"
+#include "TimingWheel.h"
+#include "Task.h"
+#include "SharedPayload.h"
 
 #include <memory>
 #include <string>
 #include <atomic>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <deque>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 class Channel;
 class EventLoop;
 class Socket;
+class Strand;
+class ReadAwaiter;
+class WriteAwaiter;
 
 /**
  *  TcpServer -> Acceptor ->有一个新用户连接，通过accept函数拿到connfd
@@ -26,6 +39,8 @@ class Socket;
 class TcpConnection : noncopyable, public std::enable_shared_from_this<TcpConnection>
 {
 public:
+    using Functor = Task;
+
     TcpConnection(EventLoop* loop,
                 const std::string& name,
                 int sockfd,
@@ -34,15 +49,48 @@ public:
     
     ~TcpConnection();
 
-    EventLoop* getLoop() const { return loop_; }
+    // 连接当前所在的loop，迁移之后会改变
+    EventLoop* getLoop() const { return loop_.load(std::memory_order_acquire); }
+    // runInLoop/queueInLoop投递的任务在哪个loop上执行，迁移途中已经是新loop
+    EventLoop* taskLoop() const { return routeLoop_.load(std::memory_order_acquire); }
     const std::string& name() const {return name_; }
     const InetAddress& localAddress() const { return localAddr_; }
     const InetAddress& peerAddress() const { return peerAddr_; }
 
     bool connected() const { return state_ == kConnected; }
+    bool disconnected() const { return state_ == kDisconnected; }
+
+    Buffer* inputBuffer() { return &inputBuffer_; }
+    Buffer* outputBuffer() { return &outputBuffer_; }
+    // 还没有发出去的字节数，包括outputBuffer_和输出段，只在loop线程中调用
+    size_t pendingOutputBytes() const { return outputBuffer_.readableBytes() + segmentBytes_; }
 
-    // 发送数据
+    /**
+     *  发送数据，都可以跨线程调用，按调用顺序发送
+     *  在连接所在的loop线程中调用时直接写socket，没写完的部分追加到outputBuffer_；
+     *  跨线程调用时数据要转交给投递的任务，各个重载转交的方式不同：
+     *  const std::string&和(data, len)拷贝一次，std::string&&移动进任务，Buffer*交换进任务，都不拷贝
+     */
     void send(const std::string& buf);
+    void send(std::string&& buf);
+    void send(const void* data, size_t len);
+    // 发送buf中的全部可读数据，发送后buf为空。输出队列为空时直接和outputBuffer_交换，不拷贝数据
+    void send(Buffer* buf);
+    // 按引用排进输出队列，连续排队的多个payload用一次writev发送，跨线程调用也只增加引用计数
+    void send(const SharedPayload& payload);
+    /**
+     *  聚集写：按顺序发送iovcnt个片段，比如协议头和消息体，不需要先拼接
+     *  在loop线程中调用时用一次writev直接发送，没写完的部分逐个片段追加到outputBuffer_；
+     *  跨线程调用时拼接成一个字符串移动进任务(拷贝一次)
+     */
+    void sendv(const struct iovec* iov, int iovcnt);
+    /**
+     *  发送文件fd中[offset, offset + length)的内容，和send的数据按调用顺序发送，可以跨线程调用
+     *  内部dup一份fd，调用者可以马上关闭自己的fd。数据用sendfile从页缓存直接发到socket，
+     *  不经过用户态缓冲区；socket写不进去时等可写事件在handleWrite中继续。
+     *  文件段计入高水位和写完成的待发送字节数
+     */
+    void sendFile(int fd, off_t offset, size_t length);
     // 关闭连接
     void shutdown();
 
@@ -64,6 +112,87 @@ public:
     void setCloseCallback(const CloseCallback& cb)
     { closeCallback_ = cb; }
 
+    // 以边缘触发模式注册socket，需要在connectEstablished之前设置
+    void setEdgeTriggered(bool on);
+    // ET模式下每次读写事件最多处理的字节数
+    void setIoBudget(size_t bytes) { ioBudget_ = bytes; }
+    /**
+     *  自动cork，需要在connectEstablished之前设置
+     *  send不再马上写socket，只追加到输出队列并把连接记为dirty，本轮循环处理完所有事件和回调之后
+     *  (EventLoop::runAtIterationEnd)统一写一次，一个消息回调里的多次小send合并成一次系统调用。
+     *  代价是数据最多推迟到本轮循环末尾才发出
+     */
+    void setAutoCork(bool on) { autoCork_ = on; }
+    // 输入输出缓冲区改用镜像环形缓冲区，capacity是环的初始大小，需要在connectEstablished之前设置
+    void setMirroredRingBuffers(size_t capacity)
+    {
+        inputBuffer_.setMirroredRing(capacity);
+        outputBuffer_.setMirroredRing(capacity);
+    }
+    /**
+     *  不小于bytes字节的消息用MSG_ZEROCOPY发送，0表示关闭(默认)，需要在connectEstablished之前设置
+     *  消息拷贝一次到单独的内存块中排进输出队列，内核直接从这块内存发送，不再拷贝到socket缓冲区；
+     *  内存块一直保留到内核通过错误队列通知发送完成。socket不支持SO_ZEROCOPY时自动关闭。
+     *  只有大消息才划算，小消息的页面锁定和完成通知的开销比拷贝还大
+     */
+    void setZeroCopyThreshold(size_t bytes) { zeroCopyThreshold_ = bytes; }
+    // 内核确认零拷贝完成的发送次数，以及内核退回拷贝(比如发往本机的连接)或者ENOBUFS时改用普通发送的次数
+    uint64_t zeroCopyHits() const { return zeroCopyHits_.load(std::memory_order_relaxed); }
+    uint64_t zeroCopyCopied() const { return zeroCopyCopied_.load(std::memory_order_relaxed); }
+
+    // 连接超时设置，单位秒，<= 0表示不启用，超时后通过handleClose关闭连接，可以跨线程调用
+    // 空闲超时：一段时间内既没有收到数据也没有发出数据
+    void setIdleTimeout(double seconds);
+    // 读超时：一段时间内没有收到数据
+    void setReadTimeout(double seconds);
+    // 写超时：输出缓冲区有待发送的数据，但一段时间内没有任何进展
+    void setWriteTimeout(double seconds);
+
+    /**
+     *  在连接所在的loop线程中执行cb，可以跨线程调用
+     *  和直接用getLoop()->runInLoop()不同，连接迁移期间投递的任务会跟着连接走，
+     *  同一个线程先后投递的任务总是按顺序执行
+     */
+    void runInLoop(Functor cb);
+    void queueInLoop(Functor cb);
+
+    /**
+     *  把耗CPU的处理放到TcpServer的计算线程池中执行，可以跨线程调用
+     *  同一个连接的任务按提交顺序串行执行，处理完后用runInLoop/send把结果交回连接所在的loop，
+     *  Task只能移动，结果可以直接move进回调，不需要拷贝。
+     *  没有开启计算线程池，或者线程池已经停止时，任务直接交给runInLoop
+     */
+    void runInWorker(Functor task);
+    // TcpServer开启计算线程池时设置
+    void setStrand(const std::shared_ptr<Strand>& strand) { strand_ = strand; }
+
+    /**
+     *  把连接迁移到另一个loop上，可以跨线程调用，用来把热点连接从过载的loop上移走
+     *  channel从原来的poller中删除再注册到新loop的poller上，输入输出缓冲区和超时设置跟着连接走，
+     *  迁移期间通过send/runInLoop投递的操作暂存起来，挂到新loop之后按顺序执行
+     */
+    void moveToLoop(EventLoop* loop);
+
+    // 读写的总字节数，只由loop线程更新，TcpServer的rebalancer跨线程读取
+    uint64_t bytesTransferred() const { return bytesTransferred_.load(std::memory_order_relaxed); }
+
+    /**
+     *  协程的挂起点，只在loop线程中设置，见Coroutine.h
+     *  设置了读等待者时，收到数据后调用它而不是messageCallback；输出缓冲区发完时调用写等待者。
+     *  返回true表示等待结束(协程已经恢复执行)，清除等待者；返回false继续等待。
+     *  连接断开时两个等待者都会被调用一次
+     */
+    using Waiter = std::function<bool()>;
+    void setReadWaiter(Waiter waiter) { readWaiter_ = std::move(waiter); }
+    void setWriteWaiter(Waiter waiter) { writeWaiter_ = std::move(waiter); }
+
+#if defined(__cpp_impl_coroutine)
+    // 协程接口，定义在Coroutine.h中，只能在连接所在的loop线程中的协程里co_await
+    ReadAwaiter readExactly(size_t n);
+    ReadAwaiter readUntil(std::string delimiter);
+    WriteAwaiter write(std::string data);
+#endif
+
     // 连接建立
     void connectEstablished();
     // 连接销毁
@@ -78,11 +207,63 @@ private:
     void handleWrite();
     void handleClose();
     void handleError();
+    void continueReading(Timestamp receiveTime);
+    void continueWriting();
 
     void sendInLoop(const void* message, size_t len);
+    void sendvInLoop(const struct iovec* iov, int iovcnt);
+    void sendFileInLoop(int fd, off_t offset, size_t length);
+    struct OutputSegment;
+    // 把一个输出段排进输出队列，前面没有排队的数据时直接发送
+    void queueSegmentInLoop(OutputSegment segment);
+    // 把输出队列最前面的一段写到socket：排在输出段前面的缓冲数据，或者输出段本身
+    ssize_t writeOutput(int* saveErrno);
+    // 从最前面的输出段开始写，返回0表示文件段提前结束
+    ssize_t writeSegment(int* saveErrno);
+    void appendOutput(const char* data, size_t len);
+    // 达到零拷贝阈值时把message移动进内存块，不再拷贝，否则同sendInLoop
+    void sendStringInLoop(std::string& message);
+    void sendBufferInLoop(Buffer* buf);
+    void sendPayloadInLoop(const SharedPayload& payload);
+    // 输出队列中新加了数据：前面没有排队的数据时直接发送，没发完的等可写事件，oldlen是加入之前待发送的字节数
+    void startOutput(size_t oldlen);
+    // 有数据要发送但还没有关注写事件：自动cork时记为dirty等本轮循环末尾发送，否则关注写事件
+    void waitForWritable();
+    void flushCorkedOutput();
+    // 输出队列发完之后：不再关注写事件，回调写完成，恢复等待的协程，完成延后的shutdown
+    void outputDrained();
+    // 读出错误队列里的零拷贝完成通知，释放内核不再引用的内存块，返回是否读到了通知
+    bool handleZeroCopyCompletions();
+
+    // 迁移的三个步骤：在旧loop上切换投递目标、在旧loop上摘除channel、在新loop上重新挂载
+    void moveToLoopInLoop(EventLoop* loop);
+    void detachFromLoop(EventLoop* loop);
+    void attachToLoop();
+    // 投递到loop上的任务，连接已经挂在当前loop上就执行，迁移途中先暂存
+    void runTask(Functor& cb);
+    // 当前线程就是连接所在的loop线程，并且没有在迁移
+    bool isInOwnerLoop() const;
+    void addBytesTransferred(size_t n)
+    { bytesTransferred_.store(bytesTransferred_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
     void shutdownInLoop();
 
-    EventLoop* loop_;       // 这里绝对不是baseLoop，因为TcpConnection都是在subLoop里面管理的
+    enum TimeoutKind { kIdleTimeout, kReadTimeout, kWriteTimeout };
+    void setTimeoutInLoop(TimeoutKind kind, double seconds);
+    // 根据当前的超时设置(重新)挂载时间轮上的节点
+    void armTimeouts();
+    void cancelTimeouts();
+    void handleTimeout(TimeoutKind kind);
+    // 连接断开时恢复还在等待的协程
+    void wakeWaiters();
+
+    std::atomic<EventLoop*> loop_;  // 这里绝对不是baseLoop，因为TcpConnection都是在subLoop里面管理的
+    std::atomic<EventLoop*> routeLoop_; // 新投递的任务发往的loop，迁移开始时先于loop_切换
+    std::mutex routeMutex_;             // 保证切换routeLoop_之前投递到旧loop的任务都排在迁移任务之前
+    bool migrating_;                    // 从moveToLoopInLoop到attachToLoop之间为true，由routeMutex_保护
+    bool attached_;                     // channel是否已经挂在loop_上，只在loop_线程中访问
+    std::vector<Functor> parkedTasks_;  // 迁移途中到达新loop的任务
+    std::atomic<uint64_t> bytesTransferred_;
+    std::shared_ptr<Strand> strand_;    // 计算线程池上这个连接的任务队列
     const std::string name_;
     std::atomic_int state_;
     bool reading_;
@@ -99,9 +280,59 @@ private:
     WriteCompleteCallback writeCompleteCallback_;   // 消息发送完成以后的回调
     HighWaterMarkCallback highWaterMarkCallback_;
     CloseCallback closeCallback_;
+    Waiter readWaiter_;
+    Waiter writeWaiter_;
     size_t highWaterMark_;
+    size_t ioBudget_;       // ET模式下单次读写事件的字节预算
+    bool autoCork_;
+    bool corked_;           // 已经在loop上登记了本轮末尾的flushCorkedOutput
+
+    static const size_t kDefaultIoBudget = 1024 * 1024;    // 1M
+    static const int kMaxWriteSegments = 64;    // 合并写内存块时一次writev最多的段数
 
     Buffer inputBuffer_;  // 接收数据的缓冲区
     Buffer outputBuffer_; // 发送数据的缓冲区
+
+    /**
+     *  不经过outputBuffer_的输出段：sendFile的文件段，或者按引用发送的内存块(零拷贝发送、SharedPayload)。
+     *  position是输出段在输出流中的位置，用写入outputBuffer_的总字节数表示：
+     *  outputBuffer_发出去的总字节数达到position之后才发送这个输出段，之后追加的数据排在它后面
+     */
+    struct OutputSegment
+    {
+        int fd;             // 文件段dup出来的fd，发送完或者连接析构时关闭；内存块为-1
+        off_t offset;       // 下一个要发送的字节在文件或者内存块中的偏移
+        size_t remaining;
+        uint64_t position;
+        std::shared_ptr<const std::string> data;    // 内存块
+        bool zeroCopy;      // 内存块用MSG_ZEROCOPY发送
+    };
+    std::deque<OutputSegment> outputSegments_;
+    size_t segmentBytes_;       // 所有输出段还没发送的字节数
+    uint64_t outputAppended_;   // 写入outputBuffer_的总字节数
+    uint64_t outputSent_;       // 从outputBuffer_发出去的总字节数
+
+    /**
+     *  零拷贝发送之后内核还在引用的内存块。每次成功的MSG_ZEROCOPY发送占用一个递增的编号，
+     *  完成通知给出一段编号[lo, hi]；TCP按发送顺序确认数据，通知也按编号顺序到达，
+     *  所以收到通知时释放编号不超过hi的所有内存块
+     */
+    struct ZeroCopyChunk
+    {
+        uint32_t id;
+        std::shared_ptr<const std::string> data;
+    };
+    std::deque<ZeroCopyChunk> zeroCopyInflight_;
+    size_t zeroCopyThreshold_;
+    uint32_t zeroCopyNextId_;   // 下一次MSG_ZEROCOPY发送的编号，和内核的计数保持一致
+    std::atomic<uint64_t> zeroCopyHits_;
+    std::atomic<uint64_t> zeroCopyCopied_;
+
+    double idleTimeout_;    // 空闲超时，秒
+    double readTimeout_;    // 读超时，秒
+    double writeTimeout_;   // 写超时，秒
+    TimingWheel::Entry idleEntry_;  // 挂在loop_时间轮上的超时节点
+    TimingWheel::Entry readEntry_;
+    TimingWheel::Entry writeEntry_;
 };
 
@@ -1,7 +1,9 @@
 #include "TcpServer.h"
 #include "Logger.h"
+#include "Strand.h"
 #include <strings.h>
 #include <functional>
+#include <future>
 
 static EventLoop* CheckLoopNotNull(EventLoop* loop)
 {
@@ -19,12 +21,25 @@ TcpServer::TcpServer(EventLoop* loop,
                 : loop_(CheckLoopNotNull(loop)),
                   ipPort_(listenAddr.toIpPort()),
                   name_(nameArg),
-                  acceptor_(new Acceptor(loop, listenAddr, option == kNoReusePort)),
+                  listenAddr_(listenAddr),
+                  option_(option),
+                  acceptor_(new Acceptor(loop, listenAddr, option != kNoReusePort)),
                   threadPool_(new EventLoopThreadPool(loop, name_)),
+                  computePool_(std::make_shared<ComputePool>(name_ + "-compute")),
                   connectionCallback_(),
                   messageCallback_(),
+                  started_(0),
                   nextConnId_(1),
-                  started_(0)
+                  edgeTriggered_(false),
+                  ioBudget_(1024 * 1024),
+                  ringBufferCapacity_(0),
+                  zeroCopyThreshold_(0),
+                  autoCork_(false),
+                  backlog_(1024),
+                  deferAcceptSeconds_(0),
+                  maxAcceptsPerWakeup_(16),
+                  rebalanceInterval_(0.0),
+                  imbalancePermille_(300)
 {
     // 当有新用户连接时，会执行TcpServer::newConnection回调
     // 把newConnection设置为acceptor的回调函数
@@ -34,15 +49,67 @@ TcpServer::TcpServer(EventLoop* loop,
 
 TcpServer::~TcpServer()
 {
-    for(auto& item : connections_)
+    loop_->cancel(rebalanceTimer_);
+
+    /**
+     *  subloop上的acceptor要在它自己的loop线程中析构，并且要等析构完成：
+     *  acceptor的回调绑定了this，析构之前它的channel还可能accept新连接并回调newConnectionInLoop
+     */
+    for(std::unique_ptr<Acceptor>& acceptor : loopAcceptors_)
+    {
+        EventLoop* ioLoop = acceptor->ownerLoop();
+        if(ioLoop->isInLoopThread())
+        {
+            acceptor.reset();
+            continue;
+        }
+        std::promise<void> done;
+        std::future<void> finished = done.get_future();
+        ioLoop->runInLoop([&acceptor, &done]() {
+            acceptor.reset();
+            done.set_value();
+        });
+        finished.wait();
+    }
+    loopAcceptors_.clear();
+
+    ConnectionMap connections;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections.swap(connections_);
+    }
+    std::vector<std::future<void>> destroyed;
+    for(auto& item : connections)
     {
         // 这是个栈上的智能指针对象，出作用域会自动释放new出来的TcpConnection对象资源
         TcpConnectionPtr conn(item.second);
         item.second.reset();    // reset()将引用计数减1
 
-        // 销毁连接
-        conn->getLoop()->runInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+        /**
+         *  销毁连接。通过conn->runInLoop投递，正在迁移的连接会在新loop上attach之后才执行connectDestroyed。
+         *  subloop上的连接要等销毁完成再停计算线程池；baseloop可能已经不在运行了，涉及baseloop的连接不等它
+         */
+        EventLoop* ioLoop = conn->getLoop();
+        EventLoop* taskLoop = conn->taskLoop();
+        if(ioLoop == loop_ || taskLoop == loop_ || ioLoop->isInLoopThread() || taskLoop->isInLoopThread())
+        {
+            conn->runInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+            continue;
+        }
+        std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+        destroyed.push_back(done->get_future());
+        conn->runInLoop([conn, done]() {
+            conn->connectDestroyed();
+            done->set_value();
+        });
+    }
+    for(std::future<void>& finished : destroyed)
+    {
+        finished.wait();
     }
+
+    // 连接都销毁之后再停计算线程池，执行完剩下的任务。Strand持有线程池的shared_ptr，停止之后的提交会失败并回到io线程执行
+    computePool_->stop();
 }
 
 // 设置底层subloop的个数
@@ -57,7 +124,93 @@ void TcpServer::start()
     if(started_++ == 0) // 防止一个TcpServer对象被start多次
     {
         threadPool_->start(threadInitCallback_);    // 启动底层的loop线程池
-        loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        computePool_->start();
+
+        std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+        if(option_ == kReusePortPerLoop && !(loops.size() == 1 && loops[0] == loop_))
+        {
+            // baseLoop不再接受连接，它的监听socket还没有listen，直接释放
+            acceptor_.reset();
+            for(size_t i = 0; i < loops.size(); ++i)
+            {
+                EventLoop* ioLoop = loops[i];
+                std::unique_ptr<Acceptor> acceptor(new Acceptor(ioLoop, listenAddr_, true));
+                configureAcceptor(acceptor.get());
+                EventLoopThreadPool::CpuSet cpus = threadPool_->loopCpuSet(i);
+                if(!cpus.empty())
+                {
+                    acceptor->setIncomingCpu(cpus.front());
+                }
+                acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnectionInLoop,
+                                        this, ioLoop, std::placeholders::_1, std::placeholders::_2));
+                ioLoop->runInLoop(std::bind(&Acceptor::listen, acceptor.get()));
+                loopAcceptors_.push_back(std::move(acceptor));
+            }
+        }
+        else
+        {
+            configureAcceptor(acceptor_.get());
+            loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        }
+
+        if(rebalanceInterval_ > 0 && threadPool_->getAllLoops().size() > 1)
+        {
+            rebalanceTimer_ = loop_->runEvery(rebalanceInterval_, std::bind(&TcpServer::rebalance, this));
+        }
+    }
+}
+
+void TcpServer::configureAcceptor(Acceptor* acceptor)
+{
+    acceptor->setBacklog(backlog_);
+    acceptor->setDeferAccept(deferAcceptSeconds_);
+    acceptor->setMaxAcceptsPerWakeup(maxAcceptsPerWakeup_);
+}
+
+std::vector<uint64_t> TcpServer::acceptsHistogram() const
+{
+    std::vector<uint64_t> histogram(Acceptor::kHistogramBuckets, 0);
+    std::vector<const Acceptor*> acceptors;
+    if(acceptor_)
+    {
+        acceptors.push_back(acceptor_.get());
+    }
+    for(const std::unique_ptr<Acceptor>& acceptor : loopAcceptors_)
+    {
+        acceptors.push_back(acceptor.get());
+    }
+    for(const Acceptor* acceptor : acceptors)
+    {
+        std::vector<uint64_t> h = acceptor->acceptsHistogram();
+        for(size_t i = 0; i < histogram.size(); ++i)
+        {
+            histogram[i] += h[i];
+        }
+    }
+    return histogram;
+}
+
+void TcpServer::broadcast(const SharedPayload& payload)
+{
+    // 按连接所在的loop分组，moveToLoop可能把连接迁到线程池以外的loop上，所以不按线程池的loop列表分组
+    std::unordered_map<EventLoop*, std::vector<TcpConnectionPtr>> groups;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto& item : connections_)
+        {
+            // 连接总在某个loop上；正在迁移的连接分到旧loop，send会把数据转给新loop
+            const TcpConnectionPtr& conn = item.second;
+            groups[conn->getLoop()].push_back(conn);
+        }
+    }
+    for(auto& group : groups)
+    {
+        group.first->queueInLoop([conns = std::move(group.second), payload]() {
+            for(const TcpConnectionPtr& conn : conns)
+            {
+                conn->send(payload);
+            }
+        });
     }
 }
 
@@ -71,11 +224,33 @@ void TcpServer::start()
  */
 void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr)
 {
-    // 轮询算法，选择一个subLoop，来管理channel
-    EventLoop* ioLoop = threadPool_->getNextLoop();
+    // 按分配策略(默认轮询)选择一个subLoop，来管理channel
+    EventLoop* ioLoop = threadPool_->getLoopForConnection(peerAddr);
+    if(threadPool_->numaLocal() && ioLoop != loop_)
+    {
+        // TcpConnection和它的缓冲区在ioLoop线程中创建，内存分配在ioLoop所在的NUMA节点上
+        ioLoop->runInLoop([this, ioLoop, sockfd, peerAddr]() {
+            newConnectionInLoop(ioLoop, sockfd, peerAddr);
+        });
+        return;
+    }
+    TcpConnectionPtr conn = createConnection(ioLoop, sockfd, peerAddr);
+
+    // 直接调用TcpConnection::connectEstablished
+    ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+}
+
+// 连接由ioLoop自己的acceptor接受，已经在ioLoop线程中了
+void TcpServer::newConnectionInLoop(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr)
+{
+    TcpConnectionPtr conn = createConnection(ioLoop, sockfd, peerAddr);
+    conn->connectEstablished();
+}
+
+TcpConnectionPtr TcpServer::createConnection(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr)
+{
     char buf[64] = {0};
-    snprintf(buf, sizeof buf, "-%s$%d", ipPort_.c_str(), nextConnId_);
-    ++nextConnId_;
+    snprintf(buf, sizeof buf, "-%s$%d", ipPort_.c_str(), nextConnId_++);
     std::string connName = name_ + buf;
     LOG_INFO("TcpServer::newConnection [%s] - new connection [%s] from %s\n",
             name_.c_str(), connName.c_str(), peerAddr.toIpPort().c_str());
@@ -93,30 +268,111 @@ void TcpServer::newConnection(int sockfd, const InetAddress& peerAddr)
     // 根据连接成功的sockfd，创建TcpConnection连接对象
     TcpConnectionPtr conn(new TcpConnection(ioLoop, connName, sockfd, localAddr, peerAddr));
     // 将刚生成的TcpConnectionPtr添加到哈希表中管理
-    connections_[connName] = conn;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_[connName] = conn;
+    }
     
     // 下面的回调都是用户设置 TcpServer=>TcpConnection=>Channel=>Poller=>notify channel调用回调
     conn->setConnectionCallback(connectionCallback_);
     conn->setMessageCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
+    if(computePool_->started())
+    {
+        conn->setStrand(std::make_shared<Strand>(computePool_));
+    }
+    if(edgeTriggered_)
+    {
+        conn->setEdgeTriggered(true);
+        conn->setIoBudget(ioBudget_);
+    }
+    if(ringBufferCapacity_ > 0)
+    {
+        conn->setMirroredRingBuffers(ringBufferCapacity_);
+    }
+    conn->setZeroCopyThreshold(zeroCopyThreshold_);
+    conn->setAutoCork(autoCork_);
 
     // 设置了如何关闭连接的回调
     conn->setCloseCallback(std::bind(&TcpServer::removeConnection, this, std::placeholders::_1));
-
-    // 直接调用TcpConnection::connectEstablished
-    ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
-
+    return conn;
 }
 
 void TcpServer::removeConnection(const TcpConnectionPtr& conn)
 {
-    loop_->runInLoop(std::bind(&TcpServer::removeConnectionInLoop, this, conn));
+    if(option_ == kReusePortPerLoop)
+    {
+        // connections_有锁保护，连接在哪个loop建立就在哪个loop移除，不用绕到baseLoop
+        removeConnectionInLoop(conn);
+    }
+    else
+    {
+        loop_->runInLoop(std::bind(&TcpServer::removeConnectionInLoop, this, conn));
+    }
 }
 
 void TcpServer::removeConnectionInLoop(const TcpConnectionPtr& conn)
 {
     LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s\n", name_.c_str(), conn->name().c_str());
-    connections_.erase(conn->name());
-    EventLoop* ioLoop = conn->getLoop();
-    ioLoop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.erase(conn->name());
+    }
+    // 连接可能正在迁移，由连接自己投递到它所在的loop
+    conn->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
 }
+
+void TcpServer::rebalance()
+{
+    std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+    EventLoop* hottest = loops[0];
+    EventLoop* coolest = loops[0];
+    for(EventLoop* loop : loops)
+    {
+        if(loop->busyPermille() > hottest->busyPermille())
+        {
+            hottest = loop;
+        }
+        if(loop->busyPermille() < coolest->busyPermille())
+        {
+            coolest = loop;
+        }
+    }
+
+    // 统计这段时间每个连接的读写量，顺便清理已经关闭的连接的记录
+    std::unordered_map<std::string, uint64_t> current;
+    TcpConnectionPtr candidate;
+    uint64_t candidateBytes = 0;
+    int activeOnHottest = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto& item : connections_)
+        {
+            const TcpConnectionPtr& conn = item.second;
+            uint64_t bytes = conn->bytesTransferred();
+            current[item.first] = bytes;
+            auto last = lastBytesTransferred_.find(item.first);
+            uint64_t delta = bytes - (last != lastBytesTransferred_.end() ? last->second : 0);
+            if(conn->getLoop() == hottest && delta > 0)
+            {
+                ++activeOnHottest;
+                if(delta > candidateBytes)
+                {
+                    candidate = conn;
+                    candidateBytes = delta;
+                }
+            }
+        }
+    }
+    lastBytesTransferred_.swap(current);
+
+    if(hottest->busyPermille() - coolest->busyPermille() < imbalancePermille_
+        || !candidate || activeOnHottest < 2)
+    {
+        return;
+    }
+    LOG_INFO("TcpServer::rebalance [%s] - move %s (%lu bytes) from loop %p(%d) to loop %p(%d)\n",
+            name_.c_str(), candidate->name().c_str(), (unsigned long)candidateBytes,
+            hottest, hottest->busyPermille(), coolest, coolest->busyPermille());
+    candidate->moveToLoop(coolest);
+}
\ No newline at end of file
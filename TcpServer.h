@@ -8,12 +8,17 @@
 #include "Callbacks.h"
 #include "TcpConnection.h"
 #include "Buffer.h"
+#include "TimerId.h"
+#include "ComputePool.h"
+#include "SharedPayload.h"
 
 #include <functional>
 #include <string>
 #include <memory>
 #include <atomic>
 #include <unordered_map>
+#include <vector>
+#include <mutex>
 
 // 对外的服务器编程使用的类
 
@@ -27,10 +32,16 @@ class TcpServer : noncopyable
 public:
     // 线程初始化函数，并不一定需要
     using ThreadInitCallback = std::function<void(EventLoop*)>;
+    /**
+     *  kReusePortPerLoop：每个subloop各自创建一个SO_REUSEPORT的监听socket和Acceptor，
+     *  由内核把新连接分散到各个监听socket上，subloop自己accept并直接建立连接，
+     *  不经过baseLoop，也没有跨线程的runInLoop。没有subloop时和kReusePort相同
+     */
     enum Option
     {
         kNoReusePort,
-        kReusePort
+        kReusePort,
+        kReusePortPerLoop,
     };
 
     // TcpServer(EventLoop* loop, const InetAddress& listenAddr);
@@ -58,16 +69,81 @@ public:
     */
     void setThreadNum(int numThreads);
 
+    // 新连接分配到subloop的策略，kReusePortPerLoop模式下由内核分配，不使用这些策略
+    void setPlacementPolicy(EventLoopThreadPool::PlacementPolicy policy) { threadPool_->setPlacementPolicy(policy); }
+    void setPlacementCallback(const EventLoopThreadPool::PlacementCallback& cb) { threadPool_->setPlacementCallback(cb); }
+
+    // 绑核和NUMA，在start之前调用，见EventLoopThreadPool。
+    // kReusePortPerLoop模式下每个loop的监听socket还会设置SO_INCOMING_CPU为它绑定的第一个CPU，
+    // 网卡RX队列的中断亲和性配到同一个CPU上时，连接从收包到处理都不会跨核
+    void setThreadCpuSets(const std::vector<EventLoopThreadPool::CpuSet>& cpuSets) { threadPool_->setThreadCpuSets(cpuSets); }
+    void setBaseLoopCpuSet(const EventLoopThreadPool::CpuSet& cpus) { threadPool_->setBaseLoopCpuSet(cpus); }
+    void setNumaLocal(bool on) { threadPool_->setNumaLocal(on); }
+
+    // 计算线程池的线程数，一定在start函数前调用，0表示不开启(默认)，见TcpConnection::runInWorker
+    void setComputeThreadNum(int numThreads) { computePool_->setThreadNum(numThreads); }
+    // 计算线程池，可以读取队列深度、偷取次数等统计信息
+    const ComputePool& computePool() const { return *computePool_; }
+
+    // 新连接以边缘触发模式注册，读写时一直处理到EAGAIN，每次最多处理ioBudget字节
+    void setEdgeTriggered(bool on, size_t ioBudget = 1024 * 1024)
+    {
+        edgeTriggered_ = on;
+        ioBudget_ = ioBudget;
+    }
+
+    // 新连接的输入输出缓冲区使用镜像环形缓冲区(见Buffer)，capacity是环的初始大小，0表示使用块链表(默认)
+    void setMirroredRingBuffers(size_t capacity) { ringBufferCapacity_ = capacity; }
+    // 新连接开启自动cork(见TcpConnection::setAutoCork)，每轮循环每个连接最多一次写系统调用，默认关闭
+    void setAutoCork(bool on) { autoCork_ = on; }
+    // 新连接上不小于bytes字节的消息用MSG_ZEROCOPY发送(见TcpConnection::setZeroCopyThreshold)，0表示关闭(默认)
+    void setZeroCopyThreshold(size_t bytes) { zeroCopyThreshold_ = bytes; }
+
+    /**
+     *  自动再平衡，一定在start函数前调用，intervalSeconds <= 0 表示关闭(默认)
+     *  每隔intervalSeconds比较各个subloop的busyPermille，最忙的loop比最闲的高出imbalancePermille以上时，
+     *  把最忙loop上这段时间读写字节最多的连接迁到最闲的loop，每次只迁一个。
+     *  最忙loop上只有这一个活跃连接时不迁移，迁过去只会让另一个loop变成热点
+     */
+    void setRebalance(double intervalSeconds, int imbalancePermille = 300)
+    {
+        rebalanceInterval_ = intervalSeconds;
+        imbalancePermille_ = imbalancePermille;
+    }
+
+    // 监听socket的选项，一定在start函数前调用
+    void setListenBacklog(int backlog) { backlog_ = backlog; }
+    void setDeferAccept(int seconds) { deferAcceptSeconds_ = seconds; }     // TCP_DEFER_ACCEPT
+    void setMaxAcceptsPerWakeup(int n) { maxAcceptsPerWakeup_ = n; }        // 每次可读事件最多accept的连接数
+
+    // 所有acceptor每次唤醒accept到的连接数的直方图之和，格式见Acceptor::acceptsHistogram，在start之后调用
+    std::vector<uint64_t> acceptsHistogram() const;
+
+    /**
+     *  把payload发给当前所有的连接，可以在任何线程中调用，在start之后调用
+     *  按连接所在的loop分组，每个loop只投递一个任务，任务中依次send(payload)，
+     *  各个连接按引用发送同一块内存，不拷贝到每个连接的outputBuffer_
+     */
+    void broadcast(const SharedPayload& payload);
+
     // 开启服务器监听
     void start();
 
 private:
     // acceptor设置的回调
     void newConnection(int sockfd, const InetAddress& peerAddr);
+    // kReusePortPerLoop模式下subloop上的acceptor设置的回调，在ioLoop线程中直接建立连接
+    void newConnectionInLoop(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr);
+    // 创建TcpConnection，设置回调并加入connections_
+    TcpConnectionPtr createConnection(EventLoop* ioLoop, int sockfd, const InetAddress& peerAddr);
+    // 把监听选项设置到acceptor上
+    void configureAcceptor(Acceptor* acceptor);
     // 移除已建立的连接
     void removeConnection(const TcpConnectionPtr& conn);
     // removeConnection中调用的连接
     void removeConnectionInLoop(const TcpConnectionPtr& conn);
+    // 定时在baseLoop中执行，迁移热点连接
+    void rebalance();
 
     // 记录已建立连接TcpConnectionPtr的hash表
     using ConnectionMap = std::unordered_map<std::string, TcpConnectionPtr>;
@@ -75,10 +151,14 @@ private:
 
     const std::string ipPort_;  //本地地址
     const std::string name_;    //服务名字
+    const InetAddress listenAddr_;
+    const Option option_;
 
     std::unique_ptr<Acceptor> acceptor_;    // 运行在mainLoop，任务就是监听新连接事件
+    std::vector<std::unique_ptr<Acceptor>> loopAcceptors_;  // kReusePortPerLoop模式下每个subloop的acceptor
 
     std::shared_ptr<EventLoopThreadPool> threadPool_;   // one loop per thread
+    std::shared_ptr<ComputePool> computePool_;          // 执行runInWorker提交的任务
 
     ConnectionCallback connectionCallback_; // 有新连接时的回调
     MessageCallback messageCallback_;       // 有读写消息时的回调
@@ -88,7 +168,21 @@ private:
 
     std::atomic_int started_;   // started_变量，调用start方法后+1，防止一个TcpServer对象被start多次
 
-    int nextConnId_;
+    std::atomic_int nextConnId_;    // 多个loop可能同时建立连接
+    bool edgeTriggered_;        // 新连接是否使用ET模式
+    size_t ioBudget_;           // ET模式下单次读写事件的字节预算
+    size_t ringBufferCapacity_; // 新连接的镜像环形缓冲区大小，0表示不使用
+    size_t zeroCopyThreshold_;  // 新连接的零拷贝发送阈值，0表示不使用
+    bool autoCork_;             // 新连接是否自动cork
+    int backlog_;
+    int deferAcceptSeconds_;
+    int maxAcceptsPerWakeup_;
+    std::mutex mutex_;              // kReusePortPerLoop模式下各个subloop会并发地增删连接
     ConnectionMap connections_;     // 保存所有的连接
 
+    double rebalanceInterval_;
+    int imbalancePermille_;
+    TimerId rebalanceTimer_;
+    std::unordered_map<std::string, uint64_t> lastBytesTransferred_;  // 上一次rebalance时各连接的读写字节数，只在baseLoop中访问
+
 };
\ No newline at end of file
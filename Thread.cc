@@ -10,7 +10,7 @@ Thread::Thread(ThreadFunc func, const std::string &name) :
     joined_(false),
     tid_(0),
     func_(std::move(func)),
-    name_(name_)
+    name_(name)
 {
     setDefaultName();
 }
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <string>
 #include <atomic>
+#include <memory>
 
 class Thread : noncopyable
 {
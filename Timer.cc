@@ -0,0 +1,16 @@
+#include "Timer.h"
+
+std::atomic<int64_t> Timer::s_numCreated_(0);
+
+void Timer::restart(Timestamp now)
+{
+    if(repeat_)
+    {
+        // 重复定时器，下一次超时时刻 = 当前时间 + 时间间隔
+        expiration_ = addTime(now, interval_);
+    }
+    else
+    {
+        expiration_ = Timestamp::invalid();
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+#include "Callbacks.h"
+
+#include <atomic>
+
+/**
+ *  Timer类 定时器
+ *  封装了定时器的超时回调、超时时刻、重复间隔，以及一个全局递增的序号
+ *  序号用来区分地址相同的不同Timer对象(前一个Timer被delete后，新的Timer可能复用同一块内存)
+ */
+class Timer : noncopyable
+{
+public:
+    Timer(TimerCallback cb, Timestamp when, double interval)
+        : callback_(std::move(cb)),
+          expiration_(when),
+          interval_(interval),
+          repeat_(interval > 0.0),
+          sequence_(++s_numCreated_)
+    {}
+
+    // 超时，执行用户设置的回调
+    void run() const { callback_(); }
+
+    Timestamp expiration() const { return expiration_; }
+    bool repeat() const { return repeat_; }
+    int64_t sequence() const { return sequence_; }
+
+    // 重复定时器，以now为基准计算下一次超时时刻
+    void restart(Timestamp now);
+
+    static int64_t numCreated() { return s_numCreated_; }
+
+private:
+    const TimerCallback callback_;  // 定时器回调
+    Timestamp expiration_;          // 下一次超时时刻
+    const double interval_;         // 超时时间间隔，单位秒，一次性定时器为0
+    const bool repeat_;             // 是否是重复定时器
+    const int64_t sequence_;        // 定时器序号
+
+    static std::atomic<int64_t> s_numCreated_;
+};
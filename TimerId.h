@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+class Timer;
+
+/**
+ *  TimerId 用户可见的定时器句柄，用来取消定时器
+ *  只包含Timer*和序号，可以拷贝，不负责Timer对象的生命周期
+ */
+class TimerId
+{
+public:
+    TimerId() : timer_(nullptr), sequence_(0) {}
+    TimerId(Timer* timer, int64_t seq) : timer_(timer), sequence_(seq) {}
+
+    friend class TimerQueue;
+private:
+    Timer* timer_;
+    int64_t sequence_;
+};
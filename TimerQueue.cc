@@ -0,0 +1,206 @@
+#include "TimerQueue.h"
+#include "Timer.h"
+#include "TimerId.h"
+#include "EventLoop.h"
+#include "Logger.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+
+// 创建timerfd，使用CLOCK_MONOTONIC，不受系统时间修改的影响
+static int createTimerfd()
+{
+    int timerfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timerfd < 0)
+    {
+        LOG_FATAL("timerfd_create error: %d\n", errno);
+    }
+    return timerfd;
+}
+
+// 计算从现在到when的时间间隔，至少100微秒，避免设置为0导致timerfd被停止
+static struct timespec howMuchTimeFromNow(Timestamp when)
+{
+    int64_t microseconds = when.microSecondsSinceEpoch()
+                            - Timestamp::now().microSecondsSinceEpoch();
+    if(microseconds < 100)
+    {
+        microseconds = 100;
+    }
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(microseconds / Timestamp::kMicroSecondsPerSecond);
+    ts.tv_nsec = static_cast<long>((microseconds % Timestamp::kMicroSecondsPerSecond) * 1000);
+    return ts;
+}
+
+// 读走timerfd上的超时次数，否则LT模式下会一直触发可读事件
+static void readTimerfd(int timerfd)
+{
+    uint64_t howmany;
+    ssize_t n = ::read(timerfd, &howmany, sizeof howmany);
+    if(n != sizeof howmany)
+    {
+        LOG_INFO("TimerQueue::handleRead() reads %ld bytes instead of 8\n", n);
+    }
+}
+
+// 把timerfd的超时时刻设置为expiration
+static void resetTimerfd(int timerfd, Timestamp expiration)
+{
+    struct itimerspec newValue;
+    struct itimerspec oldValue;
+    bzero(&newValue, sizeof newValue);
+    bzero(&oldValue, sizeof oldValue);
+    newValue.it_value = howMuchTimeFromNow(expiration);
+    if(::timerfd_settime(timerfd, 0, &newValue, &oldValue) < 0)
+    {
+        LOG_FATAL("timerfd_settime error: %d\n", errno);
+    }
+}
+
+TimerQueue::TimerQueue(EventLoop* loop)
+    : loop_(loop),
+      timerfd_(createTimerfd()),
+      timerfdChannel_(loop, timerfd_),
+      timers_(),
+      callingExpiredTimers_(false)
+{
+    timerfdChannel_.setReadCallback(std::bind(&TimerQueue::handleRead, this));
+    // timerfd的可读事件由所属loop的Poller监听
+    timerfdChannel_.enableReading();
+}
+
+TimerQueue::~TimerQueue()
+{
+    timerfdChannel_.disableAll();
+    timerfdChannel_.remove();
+    ::close(timerfd_);
+    for(const Entry& timer : timers_)
+    {
+        delete timer.second;
+    }
+}
+
+TimerId TimerQueue::addTimer(TimerCallback cb, Timestamp when, double interval)
+{
+    Timer* timer = new Timer(std::move(cb), when, interval);
+    // 跨线程添加时，runInLoop返回前定时器可能已经到期并被释放，要先取出序号
+    TimerId timerId(timer, timer->sequence());
+    loop_->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
+    return timerId;
+}
+
+void TimerQueue::cancel(TimerId timerId)
+{
+    loop_->runInLoop(std::bind(&TimerQueue::cancelInLoop, this, timerId));
+}
+
+void TimerQueue::addTimerInLoop(Timer* timer)
+{
+    bool earliestChanged = insert(timer);
+    // 新插入的定时器是最早到期的，需要重新设置timerfd的超时时刻
+    if(earliestChanged)
+    {
+        resetTimerfd(timerfd_, timer->expiration());
+    }
+}
+
+void TimerQueue::cancelInLoop(TimerId timerId)
+{
+    ActiveTimer timer(timerId.timer_, timerId.sequence_);
+    ActiveTimerSet::iterator it = activeTimers_.find(timer);
+    if(it != activeTimers_.end())
+    {
+        // 定时器还在队列中，直接删除
+        timers_.erase(Entry(it->first->expiration(), it->first));
+        delete it->first;
+        activeTimers_.erase(it);
+    }
+    else if(callingExpiredTimers_)
+    {
+        // 定时器已经到期，正在执行回调(例如在自己的回调中cancel自己)，记录下来，reset时不再重新插入
+        cancelingTimers_.insert(timer);
+    }
+}
+
+void TimerQueue::handleRead()
+{
+    Timestamp now(Timestamp::now());
+    readTimerfd(timerfd_);
+
+    std::vector<Entry> expired = getExpired(now);
+
+    callingExpiredTimers_ = true;
+    cancelingTimers_.clear();
+    for(const Entry& it : expired)
+    {
+        it.second->run();   // 执行定时器回调
+    }
+    callingExpiredTimers_ = false;
+
+    reset(expired, now);
+}
+
+std::vector<TimerQueue::Entry> TimerQueue::getExpired(Timestamp now)
+{
+    std::vector<Entry> expired;
+    // UINTPTR_MAX保证 sentry 大于所有超时时刻等于now的Entry
+    Entry sentry(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
+    TimerList::iterator end = timers_.lower_bound(sentry);
+    std::copy(timers_.begin(), end, back_inserter(expired));
+    timers_.erase(timers_.begin(), end);
+
+    for(const Entry& it : expired)
+    {
+        ActiveTimer timer(it.second, it.second->sequence());
+        activeTimers_.erase(timer);
+    }
+    return expired;
+}
+
+void TimerQueue::reset(const std::vector<Entry>& expired, Timestamp now)
+{
+    for(const Entry& it : expired)
+    {
+        ActiveTimer timer(it.second, it.second->sequence());
+        // 重复定时器，并且没有在回调中被取消，重新计算超时时刻后插入队列
+        if(it.second->repeat() && cancelingTimers_.find(timer) == cancelingTimers_.end())
+        {
+            it.second->restart(now);
+            insert(it.second);
+        }
+        else
+        {
+            delete it.second;
+        }
+    }
+
+    // 队列中还有定时器，重新设置timerfd为最早到期的超时时刻
+    if(!timers_.empty())
+    {
+        Timestamp nextExpire = timers_.begin()->second->expiration();
+        if(nextExpire.valid())
+        {
+            resetTimerfd(timerfd_, nextExpire);
+        }
+    }
+}
+
+bool TimerQueue::insert(Timer* timer)
+{
+    bool earliestChanged = false;
+    Timestamp when = timer->expiration();
+    TimerList::iterator it = timers_.begin();
+    if(it == timers_.end() || when < it->first)
+    {
+        earliestChanged = true;
+    }
+    timers_.insert(Entry(when, timer));
+    activeTimers_.insert(ActiveTimer(timer, timer->sequence()));
+    return earliestChanged;
+}
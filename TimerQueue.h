@@ -0,0 +1,61 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+#include "Callbacks.h"
+#include "Channel.h"
+
+#include <set>
+#include <vector>
+#include <utility>
+
+class EventLoop;
+class Timer;
+class TimerId;
+
+/**
+ *  定时器队列 每个EventLoop拥有一个TimerQueue
+ *  1. 使用timerfd把定时事件转换成文件描述符上的可读事件，和其他IO事件一样由Poller统一监听
+ *  2. timerfd只设置为最早到期的那个定时器的超时时刻，到期后在handleRead中一次性取出所有到期的定时器并执行回调
+ *  3. 定时器按照(超时时刻, Timer*)有序存放在std::set中，添加、删除都是O(logn)
+ *  TimerQueue的所有成员函数都只能在所属loop的线程中调用，对外的接口通过EventLoop::runInLoop转发
+ */
+class TimerQueue : noncopyable
+{
+public:
+    explicit TimerQueue(EventLoop* loop);
+    ~TimerQueue();
+
+    // 添加定时器，可以跨线程调用
+    TimerId addTimer(TimerCallback cb, Timestamp when, double interval);
+    // 取消定时器，可以跨线程调用
+    void cancel(TimerId timerId);
+
+private:
+    // 超时时刻相同的定时器用Timer*区分
+    using Entry = std::pair<Timestamp, Timer*>;
+    using TimerList = std::set<Entry>;
+    // 按照Timer*排序，用于cancel时查找定时器
+    using ActiveTimer = std::pair<Timer*, int64_t>;
+    using ActiveTimerSet = std::set<ActiveTimer>;
+
+    void addTimerInLoop(Timer* timer);
+    void cancelInLoop(TimerId timerId);
+    // timerfd可读时的回调
+    void handleRead();
+    // 取出所有超时的定时器
+    std::vector<Entry> getExpired(Timestamp now);
+    // 重复定时器重新插入队列，一次性定时器释放
+    void reset(const std::vector<Entry>& expired, Timestamp now);
+    // 插入定时器，返回最早到期的定时器是否发生了改变
+    bool insert(Timer* timer);
+
+    EventLoop* loop_;
+    const int timerfd_;
+    Channel timerfdChannel_;
+    TimerList timers_;      // 按超时时刻排序的定时器
+
+    ActiveTimerSet activeTimers_;       // 和timers_保存相同的定时器，按Timer*排序
+    bool callingExpiredTimers_;         // 是否正在执行到期定时器的回调
+    ActiveTimerSet cancelingTimers_;    // 在定时器回调中被取消的定时器，防止重复定时器被重新插入
+};
@@ -1,17 +1,23 @@
     #include "Timestamp.h"
 
+    #include <sys/time.h>
+
     Timestamp::Timestamp() : microSecondsSinceEpoch_(0) {}
-    Timestamp::Timestamp(time_t microSecondsSinceEpoch) 
+    Timestamp::Timestamp(int64_t microSecondsSinceEpoch) 
                     : microSecondsSinceEpoch_(microSecondsSinceEpoch){}
     Timestamp Timestamp::now()
     {
-        return Timestamp(time(NULL));
+        // 定时器需要微秒级精度，time(NULL)只能精确到秒
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return Timestamp(static_cast<int64_t>(tv.tv_sec) * kMicroSecondsPerSecond + tv.tv_usec);
     }
 
     std::string Timestamp::toString() const
     {
         char buf[128] = {0};
-        tm *tm_time = localtime(&microSecondsSinceEpoch_);
+        time_t seconds = static_cast<time_t>(microSecondsSinceEpoch_ / kMicroSecondsPerSecond);
+        tm *tm_time = localtime(&seconds);
         snprintf(buf, 128, "%4d/%02d/%02d %02d:%02d:%02d",
             tm_time->tm_year + 1900,
             tm_time->tm_mon + 1,
@@ -26,4 +32,4 @@
     // int main(){
     //     std::cout<<Timestamp::now().toString()<<std::endl;
     //     return 0;
-    // }
\ No newline at end of file
+    // }
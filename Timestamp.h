@@ -2,15 +2,46 @@
 
 #include<iostream>
 #include<string>
+#include <stdint.h>
 #include "time.h"
 
 class Timestamp
 {
 public:
     Timestamp();
-    explicit Timestamp(time_t microSecondsSinceEpoch); //防止隐式类型转换
+    explicit Timestamp(int64_t microSecondsSinceEpoch); //防止隐式类型转换
     static Timestamp now();
+    static Timestamp invalid() { return Timestamp(); }
     std::string toString() const;
+
+    int64_t microSecondsSinceEpoch() const { return microSecondsSinceEpoch_; }
+    bool valid() const { return microSecondsSinceEpoch_ > 0; }
+
+    static const int kMicroSecondsPerSecond = 1000 * 1000;
 private:
-    time_t microSecondsSinceEpoch_;
+    int64_t microSecondsSinceEpoch_;
 };
+
+inline bool operator<(Timestamp lhs, Timestamp rhs)
+{
+    return lhs.microSecondsSinceEpoch() < rhs.microSecondsSinceEpoch();
+}
+
+inline bool operator==(Timestamp lhs, Timestamp rhs)
+{
+    return lhs.microSecondsSinceEpoch() == rhs.microSecondsSinceEpoch();
+}
+
+// 两个时间点的差值，单位秒
+inline double timeDifference(Timestamp high, Timestamp low)
+{
+    int64_t diff = high.microSecondsSinceEpoch() - low.microSecondsSinceEpoch();
+    return static_cast<double>(diff) / Timestamp::kMicroSecondsPerSecond;
+}
+
+// 在timestamp的基础上加上seconds秒，定时器计算超时时刻时使用
+inline Timestamp addTime(Timestamp timestamp, double seconds)
+{
+    int64_t delta = static_cast<int64_t>(seconds * Timestamp::kMicroSecondsPerSecond);
+    return Timestamp(timestamp.microSecondsSinceEpoch() + delta);
+}
@@ -0,0 +1,140 @@
+#include "TimingWheel.h"
+#include "EventLoop.h"
+
+#include <math.h>
+
+TimingWheel::Entry::~Entry()
+{
+    if(wheel_ != nullptr && armed())
+    {
+        wheel_->cancel(this);
+    }
+}
+
+void TimingWheel::Entry::link(Entry* head)
+{
+    prev_ = head->prev_;
+    next_ = head;
+    head->prev_->next_ = this;
+    head->prev_ = this;
+}
+
+void TimingWheel::Entry::unlink()
+{
+    prev_->next_ = next_;
+    next_->prev_ = prev_;
+    prev_ = next_ = this;
+}
+
+TimingWheel::TimingWheel(EventLoop* loop, double tickSeconds, int numSlots)
+    : loop_(loop),
+      tickSeconds_(tickSeconds),
+      slots_(numSlots),
+      currentTick_(0),
+      numEntries_(0),
+      ticking_(false)
+{
+}
+
+TimingWheel::~TimingWheel()
+{
+    if(ticking_)
+    {
+        loop_->cancel(tickTimer_);
+    }
+    // 把还挂着的节点摘下来，避免节点析构时访问已经释放的时间轮
+    for(Entry& head : slots_)
+    {
+        while(head.next_ != &head)
+        {
+            Entry* entry = head.next_;
+            entry->unlink();
+            entry->wheel_ = nullptr;
+        }
+    }
+}
+
+void TimingWheel::arm(Entry* entry, double timeout)
+{
+    // 向上取整，再多等一格：当前这一格已经过去了一部分，保证不会提前超时
+    int64_t ticks = static_cast<int64_t>(ceil(timeout / tickSeconds_));
+    int64_t expireTick = currentTick_ + (ticks > 0 ? ticks : 1) + 1;
+
+    if(entry->armed())
+    {
+        // 延后：只更新到期tick，转到当前所在的槽时再重新挂载
+        if(expireTick >= entry->expireTick_)
+        {
+            entry->expireTick_ = expireTick;
+            return;
+        }
+        // 提前：必须挂到更早的槽上
+        entry->unlink();
+        --numEntries_;
+    }
+
+    entry->wheel_ = this;
+    entry->expireTick_ = expireTick;
+    entry->link(slotOf(expireTick));
+    ++numEntries_;
+
+    if(!ticking_)
+    {
+        ticking_ = true;
+        tickTimer_ = loop_->runEvery(tickSeconds_, std::bind(&TimingWheel::onTick, this));
+    }
+}
+
+void TimingWheel::cancel(Entry* entry)
+{
+    if(entry->armed())
+    {
+        entry->unlink();
+        --numEntries_;
+    }
+}
+
+void TimingWheel::onTick()
+{
+    ++currentTick_;
+
+    // 先把当前槽整体摘到临时链表上，回调中对其他节点的arm/cancel只是普通的链表操作
+    Entry pending;
+    Entry* head = slotOf(currentTick_);
+    if(head->next_ != head)
+    {
+        pending.next_ = head->next_;
+        pending.prev_ = head->prev_;
+        pending.next_->prev_ = &pending;
+        pending.prev_->next_ = &pending;
+        head->next_ = head->prev_ = head;
+    }
+
+    while(pending.next_ != &pending)
+    {
+        Entry* entry = pending.next_;
+        entry->unlink();
+        if(entry->expireTick_ <= currentTick_)
+        {
+            --numEntries_;
+            // 回调中可能重新arm这个节点，甚至释放节点的拥有者，所以先把回调拷贝出来
+            TimerCallback cb(entry->callback_);
+            if(cb)
+            {
+                cb();
+            }
+        }
+        else
+        {
+            // 超过一圈或者被延后的节点，挂到新的槽上
+            entry->link(slotOf(entry->expireTick_));
+        }
+    }
+
+    // 时间轮空了就停止转动，下次arm时再启动
+    if(numEntries_ == 0)
+    {
+        ticking_ = false;
+        loop_->cancel(tickTimer_);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "TimerId.h"
+
+#include <vector>
+#include <stdint.h>
+
+class EventLoop;
+
+/**
+ *  时间轮 每个EventLoop按需创建一个，用来管理海量的连接超时(空闲、读、写超时)
+ *  1. 时间轮由numSlots个槽组成，每个槽是一个带哨兵节点的双向循环链表，节点(Entry)侵入式地嵌在使用者对象中
+ *  2. 通过loop的runEvery每tick秒转动一格，处理当前槽里的节点：到期的执行回调，没到期的(超过一圈或被延后)挂到新的槽
+ *  3. arm/cancel都是O(1)；对已经挂上的节点延后超时时刻只修改expireTick_，等转到它所在的槽时再重新挂载，
+ *     所以每次读写都重置超时的场景下，重置只是一次赋值
+ *  时间轮的所有操作都只能在所属loop的线程中进行，超时会在设定时间之后的一个tick之内触发
+ */
+class TimingWheel : noncopyable
+{
+public:
+    // 挂在时间轮上的节点，由使用者持有，析构时自动从时间轮上摘除
+    class Entry : noncopyable
+    {
+    public:
+        Entry() : prev_(this), next_(this), wheel_(nullptr), expireTick_(0) {}
+        explicit Entry(TimerCallback cb) : Entry() { callback_ = std::move(cb); }
+        ~Entry();
+
+        void setCallback(TimerCallback cb) { callback_ = std::move(cb); }
+        bool armed() const { return next_ != this; }
+
+    private:
+        friend class TimingWheel;
+        void link(Entry* head);     // 挂到head链表的尾部
+        void unlink();
+
+        Entry* prev_;
+        Entry* next_;
+        TimingWheel* wheel_;
+        int64_t expireTick_;        // 到期时的tick数
+        TimerCallback callback_;
+    };
+
+    static const int kDefaultNumSlots = 512;
+
+    TimingWheel(EventLoop* loop, double tickSeconds = 1.0, int numSlots = kDefaultNumSlots);
+    ~TimingWheel();
+
+    // 设置(或重置)entry在timeout秒后超时
+    void arm(Entry* entry, double timeout);
+    // 取消entry
+    void cancel(Entry* entry);
+
+    size_t size() const { return numEntries_; }
+    double tick() const { return tickSeconds_; }
+
+private:
+    void onTick();
+    Entry* slotOf(int64_t tick) { return &slots_[static_cast<size_t>(tick % slots_.size())]; }
+
+    EventLoop* loop_;
+    const double tickSeconds_;
+    std::vector<Entry> slots_;  // 每个槽的哨兵节点
+    int64_t currentTick_;       // 时间轮已经转过的格数
+    size_t numEntries_;         // 挂在时间轮上的节点个数
+    bool ticking_;              // 驱动时间轮转动的定时器是否在运行
+    TimerId tickTimer_;
+};
@@ -0,0 +1,116 @@
+#include "TcpServer.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/**
+ *  新连接的建立速率
+ *  kNoReusePort：baseLoop上的Acceptor accept，再runInLoop把连接交给subloop；
+ *  kReusePortPerLoop：每个subloop一个SO_REUSEPORT的监听socket，自己accept并直接建立连接。
+ *  客户端线程循环connect，服务端在连接建立的回调中shutdown，客户端读到EOF后close，
+ *  TIME_WAIT留在服务端，客户端的端口可以马上复用。计时到所有客户端完成为止。
+ *
+ *  用法：accept_bench [ioThreads] [clientThreads] [connections] > /dev/null
+ *  默认4个subloop、8个客户端线程、一共20000个连接。Logger的输出在stdout上，结果打印到stderr
+ */
+
+namespace
+{
+
+bool connectOnce(const sockaddr_in& addr)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool ok = ::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) == 0;
+    if(ok)
+    {
+        char buf[64];
+        while(::read(fd, buf, sizeof buf) > 0)
+        {
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+// 返回每秒建立的连接数
+double run(TcpServer::Option option, uint16_t port, int ioThreads, int clientThreads, int connections)
+{
+    EventLoop loop;
+    InetAddress listenAddr(port, "127.0.0.1");
+    TcpServer server(&loop, listenAddr, "AcceptBench", option);
+    server.setThreadNum(ioThreads);
+
+    std::atomic<int> accepted(0);
+    server.setConnectionCallback([&accepted](const TcpConnectionPtr& conn) {
+        if(conn->connected())
+        {
+            accepted.fetch_add(1, std::memory_order_relaxed);
+            conn->shutdown();
+        }
+    });
+    server.start();
+
+    double elapsed = 0;
+    std::thread driver;
+    // loop开始运行之后再启动客户端，这时监听socket都已经listen
+    loop.runInLoop([&]() {
+        driver = std::thread([&]() {
+            const sockaddr_in addr = *listenAddr.getSockAddr();
+            const int perThread = connections / clientThreads;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::vector<std::thread> clients;
+            for(int i = 0; i < clientThreads; ++i)
+            {
+                clients.emplace_back([&addr, perThread]() {
+                    for(int j = 0; j < perThread; ++j)
+                    {
+                        connectOnce(addr);
+                    }
+                });
+            }
+            for(std::thread& client : clients)
+            {
+                client.join();
+            }
+            std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+            elapsed = d.count();
+            loop.quit();
+        });
+    });
+    loop.loop();
+    driver.join();
+    return accepted.load() / elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    int ioThreads = argc > 1 ? atoi(argv[1]) : 4;
+    int clientThreads = argc > 2 ? atoi(argv[2]) : 8;
+    int connections = argc > 3 ? atoi(argv[3]) : 20000;
+
+    ::signal(SIGPIPE, SIG_IGN);
+
+    double baseRate = run(TcpServer::kNoReusePort, 9961, ioThreads, clientThreads, connections);
+    double perLoopRate = run(TcpServer::kReusePortPerLoop, 9962, ioThreads, clientThreads, connections);
+
+    fprintf(stderr, "ioThreads=%d clientThreads=%d connections=%d\n", ioThreads, clientThreads, connections);
+    fprintf(stderr, "%-24s %12.0f conn/s\n", "baseLoop accept", baseRate);
+    fprintf(stderr, "%-24s %12.0f conn/s\n", "per-loop SO_REUSEPORT", perLoopRate);
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+/**
+ *  accept/close抖动下Poller的channel表：按fd索引的平坦表和原来的unordered_map<int, Channel*>
+ *  先打开fds个空闲的eventfd并注册到epoll中，让表中有fds个channel，然后反复：
+ *  connect一个回环连接并accept，注册读事件(ADD)，关注写事件(MOD)，disableAll(DEL)，removeChannel，
+ *  最后用SO_LINGER为0的close关掉两端，不留TIME_WAIT。新连接的fd总是落在表的末尾。
+ *  MapTable是改动之前EPollPoller的做法：unordered_map加上channel中的index_；
+ *  FlatTable和现在Poller::ChannelSlot的做法相同。
+ *  除了完整的抖动速率，还按第一遍记录下来的fd序列只重放表的操作(不做系统调用)，单独给出表操作的耗时。
+ *
+ *  用法：channel_table_bench [fds] [churns]
+ *  默认100000个fd、200000次抖动。fds加上余量超过RLIMIT_NOFILE时会缩小，并在输出中说明
+ */
+
+namespace
+{
+
+enum ChannelState
+{
+    kNew = -1,
+    kAdded = 1,
+    kDeleted = 2,
+};
+
+// 代替Channel，只保留表操作用到的字段
+struct Entry
+{
+    int fd;
+    int events;
+    int index;      // MapTable中channel的状态，对应原来的Channel::index_
+};
+
+class MapTable
+{
+public:
+    explicit MapTable(int epollfd) : epollfd_(epollfd) {}
+
+    bool hasChannel(const Entry* entry) const
+    {
+        auto it = channels_.find(entry->fd);
+        return it != channels_.end() && it->second == entry;
+    }
+
+    void updateChannel(Entry* entry)
+    {
+        if(entry->index == kNew || entry->index == kDeleted)
+        {
+            if(entry->index == kNew)
+            {
+                channels_[entry->fd] = entry;
+            }
+            entry->index = kAdded;
+            ctl(EPOLL_CTL_ADD, entry);
+        }
+        else if(entry->events == 0)
+        {
+            ctl(EPOLL_CTL_DEL, entry);
+            entry->index = kDeleted;
+        }
+        else
+        {
+            ctl(EPOLL_CTL_MOD, entry);
+        }
+    }
+
+    void removeChannel(Entry* entry)
+    {
+        channels_.erase(entry->fd);
+        if(entry->index == kAdded)
+        {
+            ctl(EPOLL_CTL_DEL, entry);
+        }
+        entry->index = kNew;
+    }
+
+private:
+    void ctl(int operation, Entry* entry)
+    {
+        if(epollfd_ < 0)
+        {
+            return;
+        }
+        epoll_event event;
+        ::memset(&event, 0, sizeof event);
+        event.events = entry->events;
+        event.data.ptr = entry;
+        ::epoll_ctl(epollfd_, operation, entry->fd, &event);
+    }
+
+    int epollfd_;
+    std::unordered_map<int, Entry*> channels_;
+};
+
+class FlatTable
+{
+public:
+    explicit FlatTable(int epollfd) : epollfd_(epollfd) {}
+
+    bool hasChannel(const Entry* entry) const
+    {
+        return static_cast<size_t>(entry->fd) < channels_.size() && channels_[entry->fd].channel == entry;
+    }
+
+    void updateChannel(Entry* entry)
+    {
+        Slot& slot = slotOf(entry->fd);
+        if(slot.state == kNew || slot.state == kDeleted)
+        {
+            slot.channel = entry;
+            slot.state = kAdded;
+            ctl(EPOLL_CTL_ADD, entry);
+        }
+        else if(entry->events == 0)
+        {
+            ctl(EPOLL_CTL_DEL, entry);
+            slot.state = kDeleted;
+        }
+        else
+        {
+            ctl(EPOLL_CTL_MOD, entry);
+        }
+    }
+
+    void removeChannel(Entry* entry)
+    {
+        Slot& slot = slotOf(entry->fd);
+        if(slot.state == kAdded)
+        {
+            ctl(EPOLL_CTL_DEL, entry);
+        }
+        slot.channel = nullptr;
+        slot.state = kNew;
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : channel(nullptr), state(kNew) {}
+        Entry* channel;
+        int state;
+    };
+
+    Slot& slotOf(int fd)
+    {
+        if(static_cast<size_t>(fd) >= channels_.size())
+        {
+            size_t size = channels_.empty() ? 64 : channels_.size();
+            while(size <= static_cast<size_t>(fd))
+            {
+                size *= 2;
+            }
+            channels_.resize(size);
+        }
+        return channels_[fd];
+    }
+
+    void ctl(int operation, Entry* entry)
+    {
+        if(epollfd_ < 0)
+        {
+            return;
+        }
+        epoll_event event;
+        ::memset(&event, 0, sizeof event);
+        event.events = entry->events;
+        event.data.ptr = entry;
+        ::epoll_ctl(epollfd_, operation, entry->fd, &event);
+    }
+
+    int epollfd_;
+    std::vector<Slot> channels_;
+};
+
+// 一个连接从建立到销毁对表的操作，和TcpConnection::connectEstablished/handleClose/connectDestroyed的顺序相同
+template <typename Table>
+void churnOne(Table* table, int fd)
+{
+    Entry entry = { fd, 0, kNew };
+    entry.events = EPOLLIN | EPOLLPRI;
+    table->updateChannel(&entry);
+    entry.events |= EPOLLOUT;
+    table->updateChannel(&entry);
+    entry.events = 0;
+    table->updateChannel(&entry);
+    if(table->hasChannel(&entry))
+    {
+        table->removeChannel(&entry);
+    }
+}
+
+struct Result
+{
+    double churnsPerSecond;
+    double tableNanosPerChurn;
+};
+
+template <typename Table>
+Result run(int fds, int churns)
+{
+    int epollfd = ::epoll_create1(EPOLL_CLOEXEC);
+    Table table(epollfd);
+
+    std::vector<Entry> idle(fds);
+    for(int i = 0; i < fds; ++i)
+    {
+        idle[i].fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        idle[i].events = EPOLLIN;
+        idle[i].index = kNew;
+        table.updateChannel(&idle[i]);
+    }
+
+    int listenfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_in addr;
+    ::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(listenfd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+    ::listen(listenfd, 1024);
+    socklen_t addrlen = sizeof addr;
+    ::getsockname(listenfd, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+
+    const struct linger noLinger = { 1, 0 };
+    std::vector<int> accepted;
+    accepted.reserve(churns);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < churns; ++i)
+    {
+        int client = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ::setsockopt(client, SOL_SOCKET, SO_LINGER, &noLinger, sizeof noLinger);
+        ::connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+        int connfd = ::accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connfd < 0)
+        {
+            ::close(client);
+            continue;
+        }
+        accepted.push_back(connfd);
+        churnOne(&table, connfd);
+        ::setsockopt(connfd, SOL_SOCKET, SO_LINGER, &noLinger, sizeof noLinger);
+        ::close(connfd);
+        ::close(client);
+    }
+    std::chrono::duration<double> churnTime = std::chrono::steady_clock::now() - start;
+
+    // 同样的fd序列只重放表的操作，表中仍然有fds个空闲channel
+    Table replay(-1);
+    for(int i = 0; i < fds; ++i)
+    {
+        idle[i].index = kNew;
+        replay.updateChannel(&idle[i]);
+    }
+    start = std::chrono::steady_clock::now();
+    for(int fd : accepted)
+    {
+        churnOne(&replay, fd);
+    }
+    std::chrono::duration<double, std::nano> tableTime = std::chrono::steady_clock::now() - start;
+
+    ::close(listenfd);
+    for(Entry& entry : idle)
+    {
+        ::close(entry.fd);
+    }
+    ::close(epollfd);
+
+    Result result;
+    result.churnsPerSecond = accepted.size() / churnTime.count();
+    result.tableNanosPerChurn = accepted.empty() ? 0 : tableTime.count() / accepted.size();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    int fds = argc > 1 ? atoi(argv[1]) : 100000;
+    int churns = argc > 2 ? atoi(argv[2]) : 200000;
+
+    // 除了空闲的fd，还要留出监听socket、一对连接、epoll和标准输入输出
+    const int kReserved = 16;
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if(static_cast<rlim_t>(fds) + kReserved > limit.rlim_cur)
+    {
+        int clamped = static_cast<int>(limit.rlim_cur) - kReserved;
+        printf("RLIMIT_NOFILE is %lu: fds clamped from %d to %d\n",
+               static_cast<unsigned long>(limit.rlim_cur), fds, clamped);
+        fds = clamped;
+    }
+
+    Result map = run<MapTable>(fds, churns);
+    Result flat = run<FlatTable>(fds, churns);
+
+    printf("fds=%d churns=%d\n", fds, churns);
+    printf("%-16s %14s %20s\n", "table", "churns/s", "table ns/churn");
+    printf("%-16s %14.0f %20.1f\n", "unordered_map", map.churnsPerSecond, map.tableNanosPerChurn);
+    printf("%-16s %14.0f %20.1f\n", "flat fd table", flat.churnsPerSecond, flat.tableNanosPerChurn);
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include "TcpServer.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "CurrentThread.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+/**
+ *  水平触发和边缘触发下每MB数据的系统调用次数
+ *  客户端通过一个连接发送N MB数据，服务端把收到的数据原样send回去，客户端收齐后结束。
+ *  服务端只有一个subloop，统计这个subloop线程上对连接socket的read/readv、write/writev，以及epoll_wait的次数。
+ *  统计的方法是在这个程序里定义同名函数：libdajunmuduo.so对这些函数的调用会先解析到这里，计数之后再调用libc中的实现。
+ *
+ *  用法：edge_trigger_bench [MB] [ioBudgetKB] > /dev/null
+ *  默认64MB，ET模式每次事件最多处理1024KB。Logger的输出在stdout上，结果打印到stderr
+ */
+
+namespace
+{
+
+std::atomic<int> g_ioTid(0);
+std::atomic<long> g_reads(0);
+std::atomic<long> g_writes(0);
+std::atomic<long> g_epollWaits(0);
+
+bool onIoThread()
+{
+    return g_ioTid.load(std::memory_order_relaxed) == CurrentThread::tid();
+}
+
+// 只统计socket上的读写，eventfd、timerfd以及Logger写stdout都不算
+bool isSocket(int fd)
+{
+    struct stat st;
+    return ::fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+template <typename Fn>
+Fn next(const char* name)
+{
+    return reinterpret_cast<Fn>(::dlsym(RTLD_NEXT, name));
+}
+
+} // namespace
+
+extern "C"
+{
+
+ssize_t read(int fd, void* buf, size_t count)
+{
+    static auto real = next<ssize_t (*)(int, void*, size_t)>("read");
+    if(onIoThread() && isSocket(fd))
+    {
+        g_reads.fetch_add(1, std::memory_order_relaxed);
+    }
+    return real(fd, buf, count);
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt)
+{
+    static auto real = next<ssize_t (*)(int, const struct iovec*, int)>("readv");
+    if(onIoThread() && isSocket(fd))
+    {
+        g_reads.fetch_add(1, std::memory_order_relaxed);
+    }
+    return real(fd, iov, iovcnt);
+}
+
+ssize_t write(int fd, const void* buf, size_t count)
+{
+    static auto real = next<ssize_t (*)(int, const void*, size_t)>("write");
+    if(onIoThread() && isSocket(fd))
+    {
+        g_writes.fetch_add(1, std::memory_order_relaxed);
+    }
+    return real(fd, buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt)
+{
+    static auto real = next<ssize_t (*)(int, const struct iovec*, int)>("writev");
+    if(onIoThread() && isSocket(fd))
+    {
+        g_writes.fetch_add(1, std::memory_order_relaxed);
+    }
+    return real(fd, iov, iovcnt);
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
+{
+    static auto real = next<int (*)(int, struct epoll_event*, int, int)>("epoll_wait");
+    if(onIoThread())
+    {
+        g_epollWaits.fetch_add(1, std::memory_order_relaxed);
+    }
+    return real(epfd, events, maxevents, timeout);
+}
+
+} // extern "C"
+
+namespace
+{
+
+struct Result
+{
+    bool ok;
+    long reads;
+    long writes;
+    long epollWaits;
+    double seconds;
+};
+
+Result run(bool edgeTriggered, uint16_t port, size_t totalBytes, size_t ioBudget)
+{
+    EventLoop loop;
+    InetAddress listenAddr(port, "127.0.0.1");
+    TcpServer server(&loop, listenAddr, "EdgeTriggerBench");
+    server.setThreadNum(1);
+    server.setEdgeTriggered(edgeTriggered, ioBudget);
+
+    server.setConnectionCallback([](const TcpConnectionPtr& conn) {
+        if(conn->connected())
+        {
+            g_ioTid = CurrentThread::tid();
+        }
+    });
+    server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+        conn->send(buf);
+    });
+    server.start();
+
+    Result result = { false, 0, 0, 0, 0 };
+    std::thread client;
+    loop.runInLoop([&]() {
+        client = std::thread([&]() {
+            int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            const sockaddr_in addr = *listenAddr.getSockAddr();
+            if(::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) < 0)
+            {
+                ::close(fd);
+                loop.quit();
+                return;
+            }
+            while(g_ioTid.load() == 0)
+            {
+                std::this_thread::yield();
+            }
+            g_reads = 0;
+            g_writes = 0;
+            g_epollWaits = 0;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::thread writer([fd, totalBytes]() {
+                std::string chunk(64 * 1024, 'e');
+                size_t sent = 0;
+                while(sent < totalBytes)
+                {
+                    ssize_t n = ::write(fd, chunk.data(), std::min(chunk.size(), totalBytes - sent));
+                    if(n <= 0)
+                    {
+                        break;
+                    }
+                    sent += n;
+                }
+            });
+            size_t received = 0;
+            bool ok = true;
+            char buf[64 * 1024];
+            while(ok && received < totalBytes)
+            {
+                ssize_t n = ::read(fd, buf, sizeof buf);
+                ok = n > 0;
+                if(ok)
+                {
+                    received += n;
+                }
+            }
+            writer.join();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            result.ok = ok;
+            result.reads = g_reads.load();
+            result.writes = g_writes.load();
+            result.epollWaits = g_epollWaits.load();
+            result.seconds = elapsed.count();
+            g_ioTid = 0;
+            ::close(fd);
+            loop.quit();
+        });
+    });
+    loop.loop();
+    client.join();
+    return result;
+}
+
+void print(const char* mode, const Result& result, double mb)
+{
+    fprintf(stderr, "%-6s %8s %12.1f %12.1f %12.1f %10.1f\n",
+            mode, result.ok ? "yes" : "no",
+            result.reads / mb, result.writes / mb, result.epollWaits / mb,
+            mb / result.seconds);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t mb = argc > 1 ? atol(argv[1]) : 64;
+    size_t ioBudget = (argc > 2 ? atol(argv[2]) : 1024) * 1024;
+
+    ::signal(SIGPIPE, SIG_IGN);
+
+    Result lt = run(false, 9965, mb << 20, ioBudget);
+    Result et = run(true, 9966, mb << 20, ioBudget);
+
+    fprintf(stderr, "%zu MB echoed through one connection, ET budget %zu KB\n", mb, ioBudget / 1024);
+    fprintf(stderr, "%-6s %8s %12s %12s %12s %10s\n", "mode", "correct", "reads/MB", "writes/MB", "epoll/MB", "MB/s");
+    print("LT", lt, static_cast<double>(mb));
+    print("ET", et, static_cast<double>(mb));
+    return lt.ok && et.ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include "TcpServer.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "CurrentThread.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+
+/**
+ *  流水线请求/响应下自动cork减少的写系统调用
+ *  客户端每次发batch个以'\n'结尾的请求，收齐这一批的响应再发下一批。
+ *  服务端对每个请求调用4次send(头、请求内容、100字节的正文、'\n')，一个subloop。
+ *  分别在不开启和开启setAutoCork时统计subloop线程的写系统调用次数(/proc/self/task/<tid>/io的syscw)，
+ *  包括write/writev以及唤醒eventfd的write。
+ *
+ *  用法：pipeline_bench [requests] [batch] > /dev/null
+ *  默认2000个请求、每批50个。Logger的输出在stdout上，结果打印到stderr
+ */
+
+namespace
+{
+
+long writeSyscalls(int tid)
+{
+    std::ifstream io("/proc/self/task/" + std::to_string(tid) + "/io");
+    std::string key;
+    long value;
+    while(io >> key >> value)
+    {
+        if(key == "syscw:")
+        {
+            return value;
+        }
+    }
+    return -1;
+}
+
+std::string response(const std::string& request)
+{
+    return "HDR:" + request + std::string(100, 'x') + "\n";
+}
+
+struct Result
+{
+    bool ok;
+    long writes;
+    double seconds;
+};
+
+Result run(bool autoCork, uint16_t port, int requests, int batch)
+{
+    EventLoop loop;
+    InetAddress listenAddr(port, "127.0.0.1");
+    TcpServer server(&loop, listenAddr, "PipelineBench");
+    server.setThreadNum(1);
+    server.setAutoCork(autoCork);
+
+    std::atomic<int> ioTid(0);
+    server.setConnectionCallback([&ioTid](const TcpConnectionPtr& conn) {
+        if(conn->connected())
+        {
+            ioTid = CurrentThread::tid();
+        }
+    });
+    server.setMessageCallback([](const TcpConnectionPtr& conn, Buffer* buf, Timestamp) {
+        while(true)
+        {
+            const char* begin = buf->peek();
+            const char* end = static_cast<const char*>(::memchr(begin, '\n', buf->readableBytes()));
+            if(end == nullptr)
+            {
+                break;
+            }
+            std::string request(begin, end);
+            buf->retrieve(end - begin + 1);
+
+            conn->send(std::string("HDR:"));
+            conn->send(request.data(), request.size());
+            conn->send(std::string(100, 'x'));
+            conn->send("\n", 1);
+        }
+    });
+    server.start();
+
+    Result result = { false, 0, 0 };
+    std::thread client;
+    loop.runInLoop([&]() {
+        client = std::thread([&]() {
+            int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            const sockaddr_in addr = *listenAddr.getSockAddr();
+            if(::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) < 0)
+            {
+                ::close(fd);
+                loop.quit();
+                return;
+            }
+            while(ioTid.load() == 0)
+            {
+                std::this_thread::yield();
+            }
+
+            long writesBefore = writeSyscalls(ioTid);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::string received;
+            std::string expected;
+            char buf[65536];
+            bool ok = true;
+            for(int i = 0; i < requests && ok; i += batch)
+            {
+                std::string requestBatch;
+                for(int j = i; j < i + batch && j < requests; ++j)
+                {
+                    std::string request = "r" + std::to_string(j);
+                    requestBatch += request + "\n";
+                    expected += response(request);
+                }
+                ok = ::write(fd, requestBatch.data(), requestBatch.size()) == static_cast<ssize_t>(requestBatch.size());
+                while(ok && received.size() < expected.size())
+                {
+                    ssize_t n = ::read(fd, buf, sizeof buf);
+                    ok = n > 0;
+                    if(ok)
+                    {
+                        received.append(buf, n);
+                    }
+                }
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            result.writes = writeSyscalls(ioTid) - writesBefore;
+            result.seconds = elapsed.count();
+            result.ok = ok && received == expected;
+            ::close(fd);
+            loop.quit();
+        });
+    });
+    loop.loop();
+    client.join();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    int requests = argc > 1 ? atoi(argv[1]) : 2000;
+    int batch = argc > 2 ? atoi(argv[2]) : 50;
+
+    ::signal(SIGPIPE, SIG_IGN);
+
+    Result plain = run(false, 9963, requests, batch);
+    Result corked = run(true, 9964, requests, batch);
+
+    fprintf(stderr, "requests=%d batch=%d sends/request=4\n", requests, batch);
+    fprintf(stderr, "%-10s %8s %16s %10s\n", "autoCork", "correct", "write syscalls", "ms");
+    fprintf(stderr, "%-10s %8s %16ld %10.1f\n", "off", plain.ok ? "yes" : "no", plain.writes, plain.seconds * 1000);
+    fprintf(stderr, "%-10s %8s %16ld %10.1f\n", "on", corked.ok ? "yes" : "no", corked.writes, corked.seconds * 1000);
+    return plain.ok && corked.ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+#include "EventLoop.h"
+#include "EventLoopThread.h"
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ *  queueInLoop的入队吞吐
+ *  MutexQueue是改成MPSC链表之前EventLoop的做法：std::mutex保护的std::vector<std::function>，
+ *  每次入队都写eventfd唤醒loop线程，loop线程加锁swap出来再逐个执行。
+ *  另一组直接调用EventLoop::queueInLoop。
+ *  每一轮P个生产者线程一共提交total个任务，计时到loop线程把所有任务执行完为止。
+ *
+ *  用法：queue_in_loop_bench [total] > /dev/null，默认200万个任务
+ *  Logger的输出在stdout上，结果打印到stderr
+ */
+
+namespace
+{
+
+class MutexQueue
+{
+public:
+    using Functor = std::function<void()>;
+
+    MutexQueue()
+        : wakeupFd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          quit_(false),
+          thread_(&MutexQueue::loop, this)
+    {
+    }
+
+    ~MutexQueue()
+    {
+        quit_ = true;
+        wakeup();
+        thread_.join();
+        ::close(wakeupFd_);
+    }
+
+    void queueInLoop(Functor cb)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            pendingFunctors_.emplace_back(std::move(cb));
+        }
+        wakeup();   // 生产者都不在loop线程中，每次都要唤醒
+    }
+
+private:
+    void wakeup()
+    {
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeupFd_, &one, sizeof one);
+        (void)n;
+    }
+
+    void loop()
+    {
+        struct pollfd pfd = { wakeupFd_, POLLIN, 0 };
+        while(!quit_)
+        {
+            ::poll(&pfd, 1, 10000);
+            uint64_t one;
+            ssize_t n = ::read(wakeupFd_, &one, sizeof one);
+            (void)n;
+
+            std::vector<Functor> functors;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                functors.swap(pendingFunctors_);
+            }
+            for(const Functor& functor : functors)
+            {
+                functor();
+            }
+        }
+    }
+
+    int wakeupFd_;
+    std::atomic_bool quit_;
+    std::mutex mutex_;
+    std::vector<Functor> pendingFunctors_;
+    std::thread thread_;
+};
+
+// 返回每秒执行的任务数(百万)
+template <typename Queue>
+double run(Queue* queue, int producers, long total)
+{
+    const long perProducer = total / producers;
+    std::atomic<long> executed(0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < producers; ++i)
+    {
+        threads.emplace_back([queue, perProducer, &executed]() {
+            for(long j = 0; j < perProducer; ++j)
+            {
+                queue->queueInLoop([&executed]() { executed.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+    }
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    while(executed.load(std::memory_order_relaxed) < perProducer * producers)
+    {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return perProducer * producers / elapsed.count() / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    long total = argc > 1 ? atol(argv[1]) : 2000000;
+
+    EventLoopThread loopThread;
+    EventLoop* loop = loopThread.startLoop();
+    MutexQueue mutexQueue;
+
+    fprintf(stderr, "%-10s %16s %16s\n", "producers", "mutex (Mops/s)", "mpsc (Mops/s)");
+    for(int producers = 1; producers <= 32; producers *= 2)
+    {
+        double mutexRate = run(&mutexQueue, producers, total);
+        double mpscRate = run(loop, producers, total);
+        fprintf(stderr, "%-10d %16.2f %16.2f\n", producers, mutexRate, mpscRate);
+    }
+    return 0;
+}